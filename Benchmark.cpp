@@ -0,0 +1,345 @@
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "Benchmark.h"
+#include "CPUDecoder.h"
+
+namespace Benchmark
+{
+	struct Result
+	{
+		TexType type;
+		int width, height;
+		std::string backend;
+		double min_us, median_us, p95_us, p99_us, mean_us;
+		// Decoded RGBA8 bytes over the median
+		double gbps;
+	};
+
+	// Calls add for every comma separated item, stopping at the first it rejects
+	static bool ParseList(const char* list, const std::function<bool(const std::string&)>& add)
+	{
+		std::string item;
+		for (const char* c = list; ; ++c)
+		{
+			if (*c && *c != ',')
+			{
+				item += *c;
+				continue;
+			}
+			if (!item.empty() && !add(item))
+				return false;
+			item.clear();
+			if (!*c)
+				return true;
+		}
+	}
+
+	static bool ParseInt(const char* val, int min, int* out)
+	{
+		char* end;
+		long v = strtol(val, &end, 10);
+		if (*end || end == val || v < min)
+			return false;
+		*out = (int)v;
+		return true;
+	}
+
+	bool ParseOption(const char* arg, Options* opts)
+	{
+		const char* val = strchr(arg, '=');
+		if (!val)
+		{
+			printf("Benchmark options take a value: %s\n", arg);
+			return false;
+		}
+		const std::string name(arg, val++);
+
+		bool ok;
+		if (name == "--formats")
+		{
+			opts->formats.clear();
+			ok = ParseList(val, [&](const std::string& item)
+			{
+				TexType type;
+				if (!GetTexTypeFromName(item.c_str(), &type))
+					return false;
+				opts->formats.push_back(type);
+				return true;
+			});
+		}
+		else if (name == "--sizes")
+		{
+			opts->sizes.clear();
+			ok = ParseList(val, [&](const std::string& item)
+			{
+				// 1024 or 1024x512
+				int w, h;
+				char x;
+				const int fields = sscanf(item.c_str(), "%d%c%d", &w, &x, &h);
+				if (fields == 1)
+					h = w;
+				else if (fields != 3 || (x != 'x' && x != 'X'))
+					return false;
+				if (w <= 0 || h <= 0)
+					return false;
+				opts->sizes.emplace_back(w, h);
+				return true;
+			});
+		}
+		else if (name == "--backends")
+		{
+			opts->backends.clear();
+			ok = ParseList(val, [&](const std::string& item)
+			{
+				opts->backends.push_back(item);
+				return true;
+			});
+		}
+		else if (name == "--warmup")
+			ok = ParseInt(val, 0, &opts->warmup);
+		else if (name == "--iterations")
+			ok = ParseInt(val, 1, &opts->iterations);
+		else if (name == "--threads")
+			ok = ParseInt(val, 0, &opts->threads);
+		else if (name == "--json")
+		{
+			opts->json_path = val;
+			ok = !opts->json_path.empty();
+		}
+		else
+		{
+			printf("Unknown benchmark option: %s\n", arg);
+			return false;
+		}
+
+		if (!ok)
+			printf("Bad value for %s: %s\n", name.c_str(), val);
+		return ok;
+	}
+
+	void PrintUsage()
+	{
+		printf("Benchmark options:\n"
+		       "\t--formats=I4,CMPR,...    formats to run (default: all)\n"
+		       "\t--sizes=1024,2048x512    texture sizes (default: 1024)\n"
+		       "\t--backends=C,SSE2-mt,GPU backends to run (default: all single threaded kernels,\n"
+		       "\t                         the best threaded one and the GPU)\n"
+		       "\t--warmup=N               untimed runs first (default: 5)\n"
+		       "\t--iterations=N           timed runs (default: 50)\n"
+		       "\t--threads=N              decode threads for -mt backends (default: all cores)\n"
+		       "\t--json=FILE              also write a JSON report\n"
+		       "CPU backends:");
+		for (const Backend& backend : GetCPUBackends())
+			printf(" %s", backend.name.c_str());
+		printf("\n");
+	}
+
+	std::vector<Backend> GetCPUBackends()
+	{
+		std::vector<Backend> backends;
+		for (int threaded = 0; threaded < 2; ++threaded)
+			for (int i = 0; i < (int)CPUKernel::COUNT; ++i)
+			{
+				const CPUKernel kernel = (CPUKernel)i;
+				if (!IsCPUKernelSupported(kernel))
+					continue;
+
+				// Every backend gets its own output, allocated up front so it isn't timed
+				auto dst = std::make_shared<std::vector<uint32_t>>();
+				Backend backend;
+				backend.name = std::string(GetCPUKernelName(kernel)) + (threaded ? "-mt" : "");
+				backend.prepare = [dst](const Input& in)
+				{
+					dst->assign((size_t)in.width * in.height, 0);
+				};
+				if (threaded)
+					backend.run = [dst, kernel](const Input& in)
+					{
+						DecodeOnCPUParallel(kernel, &(*dst)[0], in.src, in.width, in.height, in.type, in.tlut, in.tlut_fmt);
+					};
+				else
+					backend.run = [dst, kernel](const Input& in)
+					{
+						DecodeOnCPU(kernel, &(*dst)[0], in.src, in.width, in.height, in.type, in.tlut, in.tlut_fmt);
+					};
+				backends.push_back(backend);
+			}
+		return backends;
+	}
+
+	// Same data on every run and every host, so numbers stay comparable
+	static void FillRandom(std::vector<uint8_t>* data, uint32_t seed)
+	{
+		for (uint8_t& b : *data)
+		{
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			b = seed >> 24;
+		}
+	}
+
+	// Nearest rank
+	static double Percentile(const std::vector<double>& sorted, double p)
+	{
+		const size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+		return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+	}
+
+	static std::string JSONString(const std::string& str)
+	{
+		std::string out = "\"";
+		for (char c : str)
+		{
+			if (c == '"' || c == '\\')
+				out += '\\';
+			if ((unsigned char)c < 0x20)
+				c = ' ';
+			out += c;
+		}
+		return out + "\"";
+	}
+
+	static bool WriteJSON(const Options& opts, const std::vector<Result>& results)
+	{
+		FILE* file = fopen(opts.json_path.c_str(), "w");
+		if (!file)
+		{
+			printf("Couldn't open %s for writing\n", opts.json_path.c_str());
+			return false;
+		}
+
+		fprintf(file, "{\n\t\"host\": {\n");
+		fprintf(file, "\t\t\"cpu_kernel\": %s,\n", JSONString(GetCPUKernelName(GetBestCPUKernel())).c_str());
+		for (const auto& info : opts.host_info)
+			fprintf(file, "\t\t%s: %s,\n", JSONString(info.first).c_str(), JSONString(info.second).c_str());
+		fprintf(file, "\t\t\"threads\": %d\n\t},\n", GetDecodeThreadCount());
+		fprintf(file, "\t\"warmup\": %d,\n\t\"iterations\": %d,\n", opts.warmup, opts.iterations);
+		fprintf(file, "\t\"results\": [\n");
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			const Result& r = results[i];
+			fprintf(file, "\t\t{ \"format\": %s, \"width\": %d, \"height\": %d, \"backend\": %s, "
+			              "\"min_us\": %.3f, \"median_us\": %.3f, \"p95_us\": %.3f, \"p99_us\": %.3f, "
+			              "\"mean_us\": %.3f, \"gbps\": %.4f }%s\n",
+				JSONString(GetTexInfo(r.type).name).c_str(), r.width, r.height, JSONString(r.backend).c_str(),
+				r.min_us, r.median_us, r.p95_us, r.p99_us, r.mean_us, r.gbps,
+				i + 1 < results.size() ? "," : "");
+		}
+		fprintf(file, "\t]\n}\n");
+		fclose(file);
+		printf("Wrote %s\n", opts.json_path.c_str());
+		return true;
+	}
+
+	bool Run(const Options& opts, const std::vector<Backend>& backends)
+	{
+		SetDecodeThreadCount(opts.threads);
+
+		std::vector<const Backend*> selected;
+		if (opts.backends.empty())
+		{
+			const std::string best_mt = std::string(GetCPUKernelName(GetBestCPUKernel())) + "-mt";
+			for (const Backend& backend : backends)
+			{
+				const size_t len = backend.name.size();
+				if (len < 3 || backend.name.compare(len - 3, 3, "-mt") || backend.name == best_mt)
+					selected.push_back(&backend);
+			}
+		}
+		else
+		{
+			for (const std::string& name : opts.backends)
+			{
+				auto it = std::find_if(backends.begin(), backends.end(),
+					[&](const Backend& backend) { return !strcasecmp(backend.name.c_str(), name.c_str()); });
+				if (it == backends.end())
+					printf("Backend %s isn't available, skipping it\n", name.c_str());
+				else
+					selected.push_back(&*it);
+			}
+		}
+
+		std::vector<TexType> formats = opts.formats;
+		if (formats.empty())
+			for (int i = 0; i < (int)TexType::TYPE_COUNT; ++i)
+				formats.push_back((TexType)i);
+
+		if (selected.empty() || opts.sizes.empty())
+		{
+			printf("Nothing to run\n");
+			return false;
+		}
+
+		printf("%d warmup, %d timed runs, %d decode threads\n", opts.warmup, opts.iterations, GetDecodeThreadCount());
+
+		std::vector<Result> results;
+		std::vector<double> samples(opts.iterations);
+		for (TexType type : formats)
+		{
+			const TexInfo info = GetTexInfo(type);
+			for (const auto& size : opts.sizes)
+			{
+				const int w = size.first, h = size.second;
+				if (w % info.block_w || h % info.block_h)
+				{
+					printf("%-7s %5dx%-5d skipped, not a multiple of the %dx%d tile\n",
+						info.name, w, h, info.block_w, info.block_h);
+					continue;
+				}
+
+				std::vector<uint8_t> src(GetEncodedSize(type, w, h));
+				std::vector<uint8_t> tlut(GetPaletteSize(type) * 2);
+				FillRandom(&src, 0x9E3779B9u ^ (uint32_t)type);
+				FillRandom(&tlut, 0x85EBCA6Bu);
+
+				const Input in = { type, w, h, src.data(), tlut.data(), TlutFormat::RGB5A3 };
+				for (const Backend* backend : selected)
+				{
+					backend->prepare(in);
+					for (int i = 0; i < opts.warmup; ++i)
+						backend->run(in);
+
+					for (int i = 0; i < opts.iterations; ++i)
+					{
+						const auto start = std::chrono::steady_clock::now();
+						backend->run(in);
+						const auto end = std::chrono::steady_clock::now();
+						samples[i] = std::chrono::duration<double, std::micro>(end - start).count();
+					}
+					std::sort(samples.begin(), samples.end());
+
+					Result r;
+					r.type = type;
+					r.width = w;
+					r.height = h;
+					r.backend = backend->name;
+					r.min_us = samples.front();
+					r.median_us = Percentile(samples, 50);
+					r.p95_us = Percentile(samples, 95);
+					r.p99_us = Percentile(samples, 99);
+					double total = 0;
+					for (double sample : samples)
+						total += sample;
+					r.mean_us = total / samples.size();
+					r.gbps = (double)w * h * 4 / std::max(r.median_us, 1e-3) / 1000;
+					results.push_back(r);
+
+					printf("%-7s %5dx%-5d %-10s min %9.1fus  median %9.1fus  p95 %9.1fus  p99 %9.1fus  %7.2fGB/s\n",
+						info.name, w, h, r.backend.c_str(), r.min_us, r.median_us, r.p95_us, r.p99_us, r.gbps);
+				}
+			}
+		}
+
+		if (!opts.json_path.empty() && !WriteJSON(opts, results))
+			return false;
+		return !results.empty();
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#include "DecodeTypes.h"
+
+namespace Benchmark
+{
+	struct Options
+	{
+		// Empty picks every format
+		std::vector<TexType> formats;
+		std::vector<std::pair<int, int>> sizes = { { 1024, 1024 } };
+		// Empty picks every single threaded kernel, the best threaded one and whatever else is registered
+		std::vector<std::string> backends;
+		int warmup = 5;
+		int iterations = 50;
+		// 0 picks std::thread::hardware_concurrency()
+		int threads = 0;
+		std::string json_path;
+		// Extra "host" fields for the report, e.g. the GL renderer
+		std::vector<std::pair<std::string, std::string>> host_info;
+	};
+
+	struct Input
+	{
+		TexType type;
+		int width, height;
+		uint8_t* src;
+		// Only for paletted formats
+		const uint8_t* tlut;
+		TlutFormat tlut_fmt;
+	};
+
+	struct Backend
+	{
+		std::string name;
+		// Once per format and size, before the timed runs
+		std::function<void(const Input&)> prepare;
+		// One decode, returning once the result is ready
+		std::function<void(const Input&)> run;
+	};
+
+	// Parses --formats= --sizes= --backends= --warmup= --iterations= --threads= --json=
+	// Returns false, after printing why, on anything it doesn't know.
+	bool ParseOption(const char* arg, Options* opts);
+	void PrintUsage();
+
+	// The CPU kernels the host supports, single threaded and band-parallel ("SSE2", "SSE2-mt")
+	std::vector<Backend> GetCPUBackends();
+
+	// Runs every format, size and backend, prints wall time percentiles and throughput,
+	// and writes the JSON report if asked to. Returns false if nothing could be run.
+	bool Run(const Options& opts, const std::vector<Backend>& backends);
+}
@@ -0,0 +1,31 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "Benchmark.h"
+#include "CPUDecoder.h"
+
+// CPU decode kernels only, no GL, so it runs anywhere
+int main(int argc, char** argv)
+{
+	Benchmark::Options opts;
+	// From L1 resident up to well past the last level cache
+	opts.sizes = { { 32, 32 }, { 128, 128 }, { 512, 512 }, { 2048, 2048 } };
+
+	for (int i = 1; i < argc; ++i)
+		if (!strcmp(argv[i], "--help") || !Benchmark::ParseOption(argv[i], &opts))
+		{
+			printf("Usage: %s [benchmark options]\n", argv[0]);
+			Benchmark::PrintUsage();
+			return 1;
+		}
+
+	const std::vector<Benchmark::Backend> backends = Benchmark::GetCPUBackends();
+
+	// Every kernel, single threaded and band-parallel
+	if (opts.backends.empty())
+		for (const Benchmark::Backend& backend : backends)
+			opts.backends.push_back(backend.name);
+
+	printf("Best kernel: %s\n", GetCPUKernelName(GetBestCPUKernel()));
+	return Benchmark::Run(opts, backends) ? 0 : 1;
+}
@@ -2,9 +2,16 @@
 // Licensed under GPLv2+
 // Refer to the license.txt file included.
 
+#include "CPUDecoder.h"
+#include "CPUDetect.h"
 #include "DecodeTypes.h"
+#include "ThreadPool.h"
 
+#include <algorithm>
+#include <memory>
 #include <stdint.h>
+#include <string.h>
+#include <vector>
 
 #ifdef _MSC_VER
 #include <intrin.h>
@@ -12,22 +19,192 @@
 #include <x86intrin.h>
 #endif
 
-#if defined _M_GENERIC
-#  define _M_SSE 0
-#elif _MSC_VER || __INTEL_COMPILER
-#  define _M_SSE 0x402
-#elif defined __GNUC__
-# if defined __SSE4_2__
-#  define _M_SSE 0x402
-# elif defined __SSE4_1__
-#  define _M_SSE 0x401
-# elif defined __SSSE3__
-#  define _M_SSE 0x301
-# elif defined __SSE3__
-#  define _M_SSE 0x300
-# endif
+// The wider kernels are compiled for their ISA per function and only called
+// after CPUInfo says the host has it, so the file itself builds for baseline x86-64.
+#ifdef _MSC_VER
+#  define TARGET_AVX2
+#  define TARGET_AVX512
+#else
+#  define TARGET_AVX2 __attribute__((target("avx2")))
+#  define TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512bw,avx512vl")))
 #endif
 
+void DecodeOnCPU_C(uint32_t* dst, uint8_t* src, int width, int height, TexType type,
+                   const uint8_t* tlut = nullptr, TlutFormat tlut_fmt = TlutFormat::IA8);
+
+// Expands 16 intensity bytes, two rows of eight texels, to IIII texels
+static inline void StoreI8x16_SSE(uint32_t* dst, int width, __m128i i8x16)
+{
+	const __m128i ii_row0 = _mm_unpacklo_epi8(i8x16, i8x16);
+	const __m128i ii_row1 = _mm_unpackhi_epi8(i8x16, i8x16);
+
+	_mm_storeu_si128((__m128i*)(dst), _mm_unpacklo_epi16(ii_row0, ii_row0));
+	_mm_storeu_si128((__m128i*)(dst + 4), _mm_unpackhi_epi16(ii_row0, ii_row0));
+	_mm_storeu_si128((__m128i*)(dst + width), _mm_unpacklo_epi16(ii_row1, ii_row1));
+	_mm_storeu_si128((__m128i*)(dst + width + 4), _mm_unpackhi_epi16(ii_row1, ii_row1));
+}
+
+// Convert4To8 on every byte, the inputs must already be masked to 4 bits
+static inline __m128i Convert4To8x16_SSE(__m128i v)
+{
+	// No byte shifts in SSE2 but nothing crosses into the next byte
+	return _mm_or_si128(v, _mm_slli_epi16(v, 4));
+}
+
+// Decodes four RGB565 colours, still in big-endian order, to RGBA8
+static inline __m128i Decode565x4_SSE(const __m128i rgb565x4)
+{
+	// The big-endian 16-bit colors `ba` and `dc` look like 0b_gggBBBbb_RRRrrGGg in a little endian xmm register
+	// Unpack `hgfe dcba` to `hhgg ffee ddcc bbaa`, where each 32-bit word is now 0b_gggBBBbb_RRRrrGGg_gggBBBbb_RRRrrGGg
+	const __m128i c0 = _mm_unpacklo_epi16(rgb565x4, rgb565x4);
+
+	// swizzle 0b_gggBBBbb_RRRrrGGg_gggBBBbb_RRRrrGGg
+	//      to 0b_11111111_BBBbbBBB_GGggggGG_RRRrrRRR
+
+	// 0b_gggBBBbb_RRRrrGGg_gggBBBbb_RRRrrGGg &
+	// 0b_00000000_00000000_00000000_11111000 =
+	// 0b_00000000_00000000_00000000_RRRrr000
+	const __m128i r0 = _mm_and_si128(c0, _mm_set1_epi32(0x000000F8));
+	// 0b_00000000_00000000_00000000_RRRrr000 >> 5 [32] =
+	// 0b_00000000_00000000_00000000_00000RRR
+	const __m128i r1 = _mm_srli_epi32(r0, 5);
+
+	// 0b_gggBBBbb_RRRrrGGg_gggBBBbb_RRRrrGGg >> 3 [32] =
+	// 0b_000gggBB_BbbRRRrr_GGggggBB_BbbRRRrr &
+	// 0b_00000000_00000000_11111100_00000000 =
+	// 0b_00000000_00000000_GGgggg00_00000000
+	const __m128i gtmp = _mm_srli_epi32(c0, 3);
+	const __m128i g0 = _mm_and_si128(gtmp, _mm_set1_epi32(0x0000FC00));
+	// 0b_GGggggBB_BbbRRRrr_GGggggBB_Bbb00000 >> 6 [32] =
+	// 0b_000000GG_ggggBBBb_bRRRrrGG_ggggBBBb &
+	// 0b_00000000_00000000_00000011_00000000 =
+	// 0b_00000000_00000000_000000GG_00000000 =
+	const __m128i g1 = _mm_and_si128(_mm_srli_epi32(gtmp, 6), _mm_set1_epi32(0x00000300));
+
+	// 0b_gggBBBbb_RRRrrGGg_gggBBBbb_RRRrrGGg >> 5 [32] =
+	// 0b_00000ggg_BBBbbRRR_rrGGgggg_BBBbbRRR &
+	// 0b_00000000_11111000_00000000_00000000 =
+	// 0b_00000000_BBBbb000_00000000_00000000
+	const __m128i b0 = _mm_and_si128(_mm_srli_epi32(c0, 5), _mm_set1_epi32(0x00F80000));
+	// 0b_00000000_BBBbb000_00000000_00000000 >> 5 [16] =
+	// 0b_00000000_00000BBB_00000000_00000000
+	const __m128i b1 = _mm_srli_epi16(b0, 5);
+
+	// OR together the final RGB bits and the alpha component:
+	const __m128i abgr888x4 = _mm_or_si128(
+		_mm_or_si128(
+			_mm_or_si128(r0, r1),
+			_mm_or_si128(g0, g1)
+		),
+		_mm_or_si128(
+			_mm_or_si128(b0, b1),
+			_mm_set1_epi32(0xFF000000)
+		)
+	);
+
+	return abgr888x4;
+}
+
+// Four colour palette of a CMPR sub-block.
+// The third and fourth entries are 5/8 + 3/8 blends of the endpoints, matching the hardware,
+// unless the first endpoint isn't greater, in which case it's their average plus transparent.
+static inline __m128i DecodeDXTPalette_SSE(const uint8_t* src)
+{
+	const int c1 = (src[0] << 8) | src[1];
+	const int c2 = (src[2] << 8) | src[3];
+
+	// [c1, c2, x, x]
+	const __m128i endpoints = Decode565x4_SSE(_mm_cvtsi32_si128(*(const int*)src));
+	const __m128i e16 = _mm_unpacklo_epi8(endpoints, _mm_setzero_si128());
+	const __m128i e16_swap = _mm_shuffle_epi32(e16, _MM_SHUFFLE(1, 0, 3, 2));
+
+	const __m128i blend = _mm_srli_epi16(_mm_add_epi16(
+		_mm_mullo_epi16(e16, _mm_set1_epi16(5)),
+		_mm_mullo_epi16(e16_swap, _mm_set1_epi16(3))), 3);
+	const __m128i average = _mm_and_si128(_mm_avg_epu16(e16, e16_swap),
+		_mm_set_epi16(0, -1, -1, -1, -1, -1, -1, -1));
+
+	const __m128i four_colour = _mm_set1_epi32(-(c1 > c2));
+	const __m128i c34 = _mm_or_si128(_mm_and_si128(four_colour, blend), _mm_andnot_si128(four_colour, average));
+
+	return _mm_unpacklo_epi64(endpoints, _mm_packus_epi16(c34, c34));
+}
+
+static inline void DecodeDXTBlock_SSE(uint32_t* dst, const uint8_t* src, int width)
+{
+	const __m128i palette = DecodeDXTPalette_SSE(src);
+	const __m128i p0 = _mm_shuffle_epi32(palette, 0x00);
+	const __m128i p2 = _mm_shuffle_epi32(palette, 0xAA);
+	const __m128i p01 = _mm_xor_si128(p0, _mm_shuffle_epi32(palette, 0x55));
+	const __m128i p23 = _mm_xor_si128(p2, _mm_shuffle_epi32(palette, 0xFF));
+
+	// Moves each texel's two index bits down to bits 6-7 of its lane, the first texel is already there.
+	// Only the low half of each 32-bit lane is multiplied and the high half stays zero.
+	const __m128i kIndexShift = _mm_setr_epi16(1, 0, 4, 0, 16, 0, 64, 0);
+
+	for (int iy = 0; iy < 4; iy++)
+	{
+		const __m128i idx = _mm_srli_epi32(_mm_mullo_epi16(_mm_set1_epi32(src[4 + iy]), kIndexShift), 6);
+
+		// Select on the low index bit, then on the high one
+		const __m128i bit0 = _mm_srai_epi32(_mm_slli_epi32(idx, 31), 31);
+		const __m128i bit1 = _mm_srai_epi32(_mm_slli_epi32(idx, 30), 31);
+		const __m128i lo = _mm_xor_si128(p0, _mm_and_si128(bit0, p01));
+		const __m128i hi = _mm_xor_si128(p2, _mm_and_si128(bit0, p23));
+		const __m128i texels = _mm_xor_si128(lo, _mm_and_si128(bit1, _mm_xor_si128(lo, hi)));
+
+		_mm_storeu_si128((__m128i*)(dst + iy * width), texels);
+	}
+}
+
+// Eight big-endian RGB5A3 texels. Both encodings are decoded and the top bit picks one per texel.
+static inline void DecodeRGB5A3x8_SSE(uint32_t* dst, int width, __m128i rgb5a3x8)
+{
+	const __m128i kMask3 = _mm_set1_epi16(0x07);
+	const __m128i kMask4 = _mm_set1_epi16(0x0F);
+	const __m128i kMask5 = _mm_set1_epi16(0x1F);
+
+	const __m128i val = _mm_or_si128(_mm_srli_epi16(rgb5a3x8, 8), _mm_slli_epi16(rgb5a3x8, 8));
+	const __m128i opaque = _mm_srai_epi16(val, 15);
+
+	// 1RRRRRGGGGGBBBBB
+	const __m128i r5 = _mm_and_si128(_mm_srli_epi16(val, 10), kMask5);
+	const __m128i g5 = _mm_and_si128(_mm_srli_epi16(val, 5), kMask5);
+	const __m128i b5 = _mm_and_si128(val, kMask5);
+	const __m128i r_op = _mm_or_si128(_mm_slli_epi16(r5, 3), _mm_srli_epi16(r5, 2));
+	const __m128i g_op = _mm_or_si128(_mm_slli_epi16(g5, 3), _mm_srli_epi16(g5, 2));
+	const __m128i b_op = _mm_or_si128(_mm_slli_epi16(b5, 3), _mm_srli_epi16(b5, 2));
+
+	// 0AAARRRRGGGGBBBB
+	const __m128i a3 = _mm_and_si128(_mm_srli_epi16(val, 12), kMask3);
+	const __m128i r4 = _mm_and_si128(_mm_srli_epi16(val, 8), kMask4);
+	const __m128i g4 = _mm_and_si128(_mm_srli_epi16(val, 4), kMask4);
+	const __m128i b4 = _mm_and_si128(val, kMask4);
+	const __m128i a_a = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(a3, 5), _mm_slli_epi16(a3, 2)), _mm_srli_epi16(a3, 1));
+	const __m128i r_a = _mm_or_si128(_mm_slli_epi16(r4, 4), r4);
+	const __m128i g_a = _mm_or_si128(_mm_slli_epi16(g4, 4), g4);
+	const __m128i b_a = _mm_or_si128(_mm_slli_epi16(b4, 4), b4);
+
+	const __m128i r = _mm_or_si128(_mm_and_si128(opaque, r_op), _mm_andnot_si128(opaque, r_a));
+	const __m128i g = _mm_or_si128(_mm_and_si128(opaque, g_op), _mm_andnot_si128(opaque, g_a));
+	const __m128i b = _mm_or_si128(_mm_and_si128(opaque, b_op), _mm_andnot_si128(opaque, b_a));
+	const __m128i a = _mm_or_si128(_mm_srli_epi16(opaque, 8), a_a);
+
+	const __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+	const __m128i ba = _mm_or_si128(b, _mm_slli_epi16(a, 8));
+	_mm_storeu_si128((__m128i*)(dst), _mm_unpacklo_epi16(rg, ba));
+	_mm_storeu_si128((__m128i*)(dst + width), _mm_unpackhi_epi16(rg, ba));
+}
+
+// AR pairs are 0xRRAA and GB pairs 0xBBGG in a register, recombine them into RG and BA
+static inline void DecodeRGBA8x8_SSE(uint32_t* dst, int width, __m128i ar, __m128i gb)
+{
+	const __m128i rg = _mm_or_si128(_mm_srli_epi16(ar, 8), _mm_slli_epi16(gb, 8));
+	const __m128i ba = _mm_or_si128(_mm_srli_epi16(gb, 8), _mm_slli_epi16(ar, 8));
+	_mm_storeu_si128((__m128i*)(dst), _mm_unpacklo_epi16(rg, ba));
+	_mm_storeu_si128((__m128i*)(dst + width), _mm_unpackhi_epi16(rg, ba));
+}
+
 void DecodeOnCPU_SSE(uint32_t* dst, uint8_t* src, int width, int height, TexType type)
 {
 	const int Wsteps4 = (width + 3) / 4;
@@ -35,15 +212,79 @@ void DecodeOnCPU_SSE(uint32_t* dst, uint8_t* src, int width, int height, TexType
 
 	switch(type)
 	{
+	case TexType::TYPE_I4:
+		{
+			// Eight rows of four bytes per tile, high nibble first
+			const __m128i kMask4 = _mm_set1_epi8(0x0F);
+			for (int y = 0; y < height; y += 8)
+				for (int x = 0, yStep = (y / 8) * Wsteps8; x < width; x += 8, yStep++)
+					for (int iy = 0; iy < 8; iy += 4)
+					{
+						const __m128i i4x32 = _mm_loadu_si128((__m128i*)(src + 32 * yStep + 4 * iy));
+						const __m128i hi = Convert4To8x16_SSE(_mm_and_si128(_mm_srli_epi16(i4x32, 4), kMask4));
+						const __m128i lo = Convert4To8x16_SSE(_mm_and_si128(i4x32, kMask4));
+
+						uint32_t* ptr = dst + (y + iy) * width + x;
+						StoreI8x16_SSE(ptr, width, _mm_unpacklo_epi8(hi, lo));
+						StoreI8x16_SSE(ptr + 2 * width, width, _mm_unpackhi_epi8(hi, lo));
+					}
+		}
+	break;
+	case TexType::TYPE_I8:
+		for (int y = 0; y < height; y += 4)
+			for (int x = 0, yStep = (y / 4) * Wsteps8; x < width; x += 8, yStep++)
+			{
+				const __m128i* tile = (__m128i*)(src + 32 * yStep);
+				uint32_t* ptr = dst + y * width + x;
+				StoreI8x16_SSE(ptr, width, _mm_loadu_si128(tile));
+				StoreI8x16_SSE(ptr + 2 * width, width, _mm_loadu_si128(tile + 1));
+			}
+	break;
+	case TexType::TYPE_IA4:
+		{
+			// 0bAAAAIIII -> IIII texels with alpha
+			const __m128i kMask4 = _mm_set1_epi8(0x0F);
+			for (int y = 0; y < height; y += 4)
+				for (int x = 0, yStep = (y / 4) * Wsteps8; x < width; x += 8, yStep++)
+					for (int iy = 0; iy < 4; iy += 2)
+					{
+						const __m128i ia4x16 = _mm_loadu_si128((__m128i*)(src + 32 * yStep + 8 * iy));
+						const __m128i a = Convert4To8x16_SSE(_mm_and_si128(_mm_srli_epi16(ia4x16, 4), kMask4));
+						const __m128i i = Convert4To8x16_SSE(_mm_and_si128(ia4x16, kMask4));
+
+						const __m128i ii_lo = _mm_unpacklo_epi8(i, i);
+						const __m128i ii_hi = _mm_unpackhi_epi8(i, i);
+						const __m128i ia_lo = _mm_unpacklo_epi8(i, a);
+						const __m128i ia_hi = _mm_unpackhi_epi8(i, a);
+
+						uint32_t* ptr = dst + (y + iy) * width + x;
+						_mm_storeu_si128((__m128i*)(ptr), _mm_unpacklo_epi16(ii_lo, ia_lo));
+						_mm_storeu_si128((__m128i*)(ptr + 4), _mm_unpackhi_epi16(ii_lo, ia_lo));
+						_mm_storeu_si128((__m128i*)(ptr + width), _mm_unpacklo_epi16(ii_hi, ia_hi));
+						_mm_storeu_si128((__m128i*)(ptr + width + 4), _mm_unpackhi_epi16(ii_hi, ia_hi));
+					}
+		}
+	break;
+	case TexType::TYPE_IA8:
+		for (int y = 0; y < height; y += 4)
+			for (int x = 0, yStep = (y / 4) * Wsteps4; x < width; x += 4, yStep++)
+				for (int iy = 0; iy < 4; iy += 2)
+				{
+					// Each 16-bit texel is AAAAAAAA_IIIIIIII in memory, so 0xIIAA in a register
+					const __m128i ai = _mm_loadu_si128((__m128i*)(src + 32 * yStep + 8 * iy));
+					const __m128i i = _mm_srli_epi16(ai, 8);
+					const __m128i ii = _mm_or_si128(i, _mm_slli_epi16(i, 8));
+					const __m128i ia = _mm_or_si128(i, _mm_slli_epi16(ai, 8));
+
+					uint32_t* ptr = dst + (y + iy) * width + x;
+					_mm_storeu_si128((__m128i*)(ptr), _mm_unpacklo_epi16(ii, ia));
+					_mm_storeu_si128((__m128i*)(ptr + width), _mm_unpackhi_epi16(ii, ia));
+				}
+	break;
 	case TexType::TYPE_RGB565:
 		{
 			// JSD optimized with SSE2 intrinsics.
 			// Produces an ~78% speed improvement over reference C implementation.
-			const __m128i kMaskR0 = _mm_set1_epi32(0x000000F8);
-			const __m128i kMaskG0 = _mm_set1_epi32(0x0000FC00);
-			const __m128i kMaskG1 = _mm_set1_epi32(0x00000300);
-			const __m128i kMaskB0 = _mm_set1_epi32(0x00F80000);
-			const __m128i kAlpha  = _mm_set1_epi32(0xFF000000);
 			for (int y = 0; y < height; y += 4)
 				for (int x = 0, yStep = (y / 4) * Wsteps4; x < width; x += 4, yStep++)
 					for (int iy = 0, xStep = 4 * yStep; iy < 4; iy++, xStep++)
@@ -53,53 +294,7 @@ void DecodeOnCPU_SSE(uint32_t* dst, uint8_t* src, int width, int height, TexType
 						// where hg, fe, ba, and dc are 16-bit colors in big-endian order
 						const __m128i rgb565x4 = _mm_loadl_epi64(dxtsrc);
 
-						// The big-endian 16-bit colors `ba` and `dc` look like 0b_gggBBBbb_RRRrrGGg in a little endian xmm register
-						// Unpack `hgfe dcba` to `hhgg ffee ddcc bbaa`, where each 32-bit word is now 0b_gggBBBbb_RRRrrGGg_gggBBBbb_RRRrrGGg
-						const __m128i c0 = _mm_unpacklo_epi16(rgb565x4, rgb565x4);
-
-						// swizzle 0b_gggBBBbb_RRRrrGGg_gggBBBbb_RRRrrGGg
-						//      to 0b_11111111_BBBbbBBB_GGggggGG_RRRrrRRR
-
-						// 0b_gggBBBbb_RRRrrGGg_gggBBBbb_RRRrrGGg &
-						// 0b_00000000_00000000_00000000_11111000 =
-						// 0b_00000000_00000000_00000000_RRRrr000
-						const __m128i r0 = _mm_and_si128(c0, kMaskR0);
-						// 0b_00000000_00000000_00000000_RRRrr000 >> 5 [32] =
-						// 0b_00000000_00000000_00000000_00000RRR
-						const __m128i r1 = _mm_srli_epi32(r0, 5);
-
-						// 0b_gggBBBbb_RRRrrGGg_gggBBBbb_RRRrrGGg >> 3 [32] =
-						// 0b_000gggBB_BbbRRRrr_GGggggBB_BbbRRRrr &
-						// 0b_00000000_00000000_11111100_00000000 =
-						// 0b_00000000_00000000_GGgggg00_00000000
-						const __m128i gtmp = _mm_srli_epi32(c0, 3);
-						const __m128i g0 = _mm_and_si128(gtmp, kMaskG0);
-						// 0b_GGggggBB_BbbRRRrr_GGggggBB_Bbb00000 >> 6 [32] =
-						// 0b_000000GG_ggggBBBb_bRRRrrGG_ggggBBBb &
-						// 0b_00000000_00000000_00000011_00000000 =
-						// 0b_00000000_00000000_000000GG_00000000 =
-						const __m128i g1 = _mm_and_si128(_mm_srli_epi32(gtmp, 6), kMaskG1);
-
-						// 0b_gggBBBbb_RRRrrGGg_gggBBBbb_RRRrrGGg >> 5 [32] =
-						// 0b_00000ggg_BBBbbRRR_rrGGgggg_BBBbbRRR &
-						// 0b_00000000_11111000_00000000_00000000 =
-						// 0b_00000000_BBBbb000_00000000_00000000
-						const __m128i b0 = _mm_and_si128(_mm_srli_epi32(c0, 5), kMaskB0);
-						// 0b_00000000_BBBbb000_00000000_00000000 >> 5 [16] =
-						// 0b_00000000_00000BBB_00000000_00000000
-						const __m128i b1 = _mm_srli_epi16(b0, 5);
-
-						// OR together the final RGB bits and the alpha component:
-						const __m128i abgr888x4 = _mm_or_si128(
-							_mm_or_si128(
-								_mm_or_si128(r0, r1),
-								_mm_or_si128(g0, g1)
-							),
-							_mm_or_si128(
-								_mm_or_si128(b0, b1),
-								kAlpha
-							)
-						);
+						const __m128i abgr888x4 = Decode565x4_SSE(rgb565x4);
 
 						__m128i *ptr = (__m128i *)(dst + (y + iy) * width + x);
 						_mm_storeu_si128(ptr, abgr888x4);
@@ -107,6 +302,224 @@ void DecodeOnCPU_SSE(uint32_t* dst, uint8_t* src, int width, int height, TexType
 		}
 
 	break;
+	case TexType::TYPE_RGB5A3:
+		for (int y = 0; y < height; y += 4)
+			for (int x = 0, yStep = (y / 4) * Wsteps4; x < width; x += 4, yStep++)
+				for (int iy = 0; iy < 4; iy += 2)
+					DecodeRGB5A3x8_SSE(dst + (y + iy) * width + x, width,
+						_mm_loadu_si128((__m128i*)(src + 32 * yStep + 8 * iy)));
+	break;
+	case TexType::TYPE_RGBA8:
+		for (int y = 0; y < height; y += 4)
+			for (int x = 0, yStep = (y / 4) * Wsteps4; x < width; x += 4, yStep++)
+			{
+				const __m128i* tile = (__m128i*)(src + 64 * yStep);
+				uint32_t* ptr = dst + y * width + x;
+				DecodeRGBA8x8_SSE(ptr, width, _mm_loadu_si128(tile), _mm_loadu_si128(tile + 2));
+				DecodeRGBA8x8_SSE(ptr + 2 * width, width, _mm_loadu_si128(tile + 1), _mm_loadu_si128(tile + 3));
+			}
+	break;
+	case TexType::TYPE_CMPR:
+		for (int y = 0; y < height; y += 8)
+			for (int x = 0, yStep = (y / 8) * Wsteps8; x < width; x += 8, yStep++)
+			{
+				const uint8_t* tile = src + 32 * yStep;
+				uint32_t* ptr = dst + y * width + x;
+				DecodeDXTBlock_SSE(ptr, tile, width);
+				DecodeDXTBlock_SSE(ptr + 4, tile + 8, width);
+				DecodeDXTBlock_SSE(ptr + 4 * width, tile + 16, width);
+				DecodeDXTBlock_SSE(ptr + 4 * width + 4, tile + 24, width);
+			}
+	break;
+	default:
+		DecodeOnCPU_C(dst, src, width, height, type);
+	break;
+	}
+}
+
+TARGET_AVX2 static inline __m256i Decode565x8_AVX2(__m256i rgb565x8)
+{
+	// Same swizzle as the SSE2 path, on eight colours at once.
+	// Duplicate each colour into both halves of its 32-bit word first.
+	const __m256i c0 = _mm256_or_si256(rgb565x8, _mm256_slli_epi32(rgb565x8, 16));
+
+	const __m256i r0 = _mm256_and_si256(c0, _mm256_set1_epi32(0x000000F8));
+	const __m256i r1 = _mm256_srli_epi32(r0, 5);
+
+	const __m256i gtmp = _mm256_srli_epi32(c0, 3);
+	const __m256i g0 = _mm256_and_si256(gtmp, _mm256_set1_epi32(0x0000FC00));
+	const __m256i g1 = _mm256_and_si256(_mm256_srli_epi32(gtmp, 6), _mm256_set1_epi32(0x00000300));
+
+	const __m256i b0 = _mm256_and_si256(_mm256_srli_epi32(c0, 5), _mm256_set1_epi32(0x00F80000));
+	const __m256i b1 = _mm256_srli_epi16(b0, 5);
+
+	return _mm256_or_si256(
+		_mm256_or_si256(
+			_mm256_or_si256(r0, r1),
+			_mm256_or_si256(g0, g1)
+		),
+		_mm256_or_si256(
+			_mm256_or_si256(b0, b1),
+			_mm256_set1_epi32(0xFF000000)
+		)
+	);
+}
+
+TARGET_AVX2 static inline void DecodeBlock565_AVX2(uint32_t* dst, const uint8_t* src, int width)
+{
+	// The whole 4x4 block is 32 bytes, rows 0-1 in the low lane and rows 2-3 in the high lane
+	const __m256i block = _mm256_loadu_si256((const __m256i*)src);
+	const __m256i rows01 = Decode565x8_AVX2(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(block)));
+	const __m256i rows23 = Decode565x8_AVX2(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(block, 1)));
+
+	_mm_storeu_si128((__m128i*)(dst + 0 * width), _mm256_castsi256_si128(rows01));
+	_mm_storeu_si128((__m128i*)(dst + 1 * width), _mm256_extracti128_si256(rows01, 1));
+	_mm_storeu_si128((__m128i*)(dst + 2 * width), _mm256_castsi256_si128(rows23));
+	_mm_storeu_si128((__m128i*)(dst + 3 * width), _mm256_extracti128_si256(rows23, 1));
+}
+
+TARGET_AVX2 static inline void DecodeBlockRGBA8_AVX2(uint32_t* dst, const uint8_t* src, int width)
+{
+	// Both halves of the tile, all 16 texels each
+	const __m256i ar = _mm256_loadu_si256((const __m256i*)src);
+	const __m256i gb = _mm256_loadu_si256((const __m256i*)(src + 32));
+
+	const __m256i rg = _mm256_or_si256(_mm256_srli_epi16(ar, 8), _mm256_slli_epi16(gb, 8));
+	const __m256i ba = _mm256_or_si256(_mm256_srli_epi16(gb, 8), _mm256_slli_epi16(ar, 8));
+
+	// Unpacks stay within 128-bit lanes, so these are rows 0/2 and 1/3
+	const __m256i rows02 = _mm256_unpacklo_epi16(rg, ba);
+	const __m256i rows13 = _mm256_unpackhi_epi16(rg, ba);
+
+	_mm_storeu_si128((__m128i*)(dst + 0 * width), _mm256_castsi256_si128(rows02));
+	_mm_storeu_si128((__m128i*)(dst + 1 * width), _mm256_castsi256_si128(rows13));
+	_mm_storeu_si128((__m128i*)(dst + 2 * width), _mm256_extracti128_si256(rows02, 1));
+	_mm_storeu_si128((__m128i*)(dst + 3 * width), _mm256_extracti128_si256(rows13, 1));
+}
+
+TARGET_AVX2 static inline void DecodeDXTBlock_AVX2(uint32_t* dst, const uint8_t* src, int width)
+{
+	// Palette in both lanes so the indices can go straight through a permute
+	const __m256i palette = _mm256_broadcastsi128_si256(DecodeDXTPalette_SSE(src));
+	const __m256i bits = _mm256_set1_epi32(*(const int*)(src + 4));
+	const __m256i kMask = _mm256_set1_epi32(3);
+
+	const __m256i idx01 = _mm256_and_si256(_mm256_srlv_epi32(bits, _mm256_setr_epi32(6, 4, 2, 0, 14, 12, 10, 8)), kMask);
+	const __m256i idx23 = _mm256_and_si256(_mm256_srlv_epi32(bits, _mm256_setr_epi32(22, 20, 18, 16, 30, 28, 26, 24)), kMask);
+	const __m256i rows01 = _mm256_permutevar8x32_epi32(palette, idx01);
+	const __m256i rows23 = _mm256_permutevar8x32_epi32(palette, idx23);
+
+	_mm_storeu_si128((__m128i*)(dst + 0 * width), _mm256_castsi256_si128(rows01));
+	_mm_storeu_si128((__m128i*)(dst + 1 * width), _mm256_extracti128_si256(rows01, 1));
+	_mm_storeu_si128((__m128i*)(dst + 2 * width), _mm256_castsi256_si128(rows23));
+	_mm_storeu_si128((__m128i*)(dst + 3 * width), _mm256_extracti128_si256(rows23, 1));
+}
+
+TARGET_AVX2 void DecodeOnCPU_AVX2(uint32_t* dst, uint8_t* src, int width, int height, TexType type)
+{
+	const int Wsteps4 = (width + 3) / 4;
+	const int Wsteps8 = (width + 7) / 8;
+
+	switch(type)
+	{
+	case TexType::TYPE_RGB565:
+		// One 4x4 block per iteration
+		for (int y = 0; y < height; y += 4)
+			for (int x = 0, yStep = (y / 4) * Wsteps4; x < width; x += 4, yStep++)
+				DecodeBlock565_AVX2(dst + y * width + x, src + 32 * yStep, width);
+	break;
+	case TexType::TYPE_RGBA8:
+		for (int y = 0; y < height; y += 4)
+			for (int x = 0, yStep = (y / 4) * Wsteps4; x < width; x += 4, yStep++)
+				DecodeBlockRGBA8_AVX2(dst + y * width + x, src + 64 * yStep, width);
+	break;
+	case TexType::TYPE_CMPR:
+		for (int y = 0; y < height; y += 8)
+			for (int x = 0, yStep = (y / 8) * Wsteps8; x < width; x += 8, yStep++)
+			{
+				const uint8_t* tile = src + 32 * yStep;
+				uint32_t* ptr = dst + y * width + x;
+				DecodeDXTBlock_AVX2(ptr, tile, width);
+				DecodeDXTBlock_AVX2(ptr + 4, tile + 8, width);
+				DecodeDXTBlock_AVX2(ptr + 4 * width, tile + 16, width);
+				DecodeDXTBlock_AVX2(ptr + 4 * width + 4, tile + 24, width);
+			}
+	break;
+	default:
+		DecodeOnCPU_SSE(dst, src, width, height, type);
+	break;
+	}
+}
+
+TARGET_AVX512 static inline __m512i Decode565x16_AVX512(__m512i rgb565x16)
+{
+	const __m512i c0 = _mm512_or_si512(rgb565x16, _mm512_slli_epi32(rgb565x16, 16));
+
+	const __m512i r0 = _mm512_and_si512(c0, _mm512_set1_epi32(0x000000F8));
+	const __m512i r1 = _mm512_srli_epi32(r0, 5);
+
+	const __m512i gtmp = _mm512_srli_epi32(c0, 3);
+	const __m512i g0 = _mm512_and_si512(gtmp, _mm512_set1_epi32(0x0000FC00));
+	const __m512i g1 = _mm512_and_si512(_mm512_srli_epi32(gtmp, 6), _mm512_set1_epi32(0x00000300));
+
+	const __m512i b0 = _mm512_and_si512(_mm512_srli_epi32(c0, 5), _mm512_set1_epi32(0x00F80000));
+	const __m512i b1 = _mm512_srli_epi16(b0, 5);
+
+	return _mm512_or_si512(
+		_mm512_or_si512(
+			_mm512_or_si512(r0, r1),
+			_mm512_or_si512(g0, g1)
+		),
+		_mm512_or_si512(
+			_mm512_or_si512(b0, b1),
+			_mm512_set1_epi32(0xFF000000)
+		)
+	);
+}
+
+// Reorders two horizontally adjacent 4x4 blocks into four 8 texel rows
+alignas(64) static const uint16_t kRowOrder565_AVX512[32] = {
+	 0,  1,  2,  3, 16, 17, 18, 19,
+	 4,  5,  6,  7, 20, 21, 22, 23,
+	 8,  9, 10, 11, 24, 25, 26, 27,
+	12, 13, 14, 15, 28, 29, 30, 31,
+};
+
+TARGET_AVX512 void DecodeOnCPU_AVX512(uint32_t* dst, uint8_t* src, int width, int height, TexType type)
+{
+	const int Wsteps4 = (width + 3) / 4;
+
+	switch(type)
+	{
+	case TexType::TYPE_RGB565:
+		{
+			// Two 4x4 blocks per iteration, so every store is a full 8 texel row
+			const __m512i row_order = _mm512_load_si512((const __m512i*)kRowOrder565_AVX512);
+			for (int y = 0; y < height; y += 4)
+			{
+				int x = 0, yStep = (y / 4) * Wsteps4;
+				for (; x + 8 <= width; x += 8, yStep += 2)
+				{
+					const __m512i blocks = _mm512_permutexvar_epi16(row_order, _mm512_loadu_si512(src + 32 * yStep));
+					const __m512i rows01 = Decode565x16_AVX512(_mm512_cvtepu16_epi32(_mm512_castsi512_si256(blocks)));
+					const __m512i rows23 = Decode565x16_AVX512(_mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(blocks, 1)));
+
+					uint32_t* ptr = dst + y * width + x;
+					_mm256_storeu_si256((__m256i*)(ptr + 0 * width), _mm512_castsi512_si256(rows01));
+					_mm256_storeu_si256((__m256i*)(ptr + 1 * width), _mm512_extracti64x4_epi64(rows01, 1));
+					_mm256_storeu_si256((__m256i*)(ptr + 2 * width), _mm512_castsi512_si256(rows23));
+					_mm256_storeu_si256((__m256i*)(ptr + 3 * width), _mm512_extracti64x4_epi64(rows23, 1));
+				}
+
+				// Odd block left over at the end of the row
+				for (; x < width; x += 4, yStep++)
+					DecodeBlock565_AVX2(dst + y * width + x, src + 32 * yStep, width);
+			}
+		}
+	break;
+	default:
+		DecodeOnCPU_AVX2(dst, src, width, height, type);
+	break;
 	}
 }
 
@@ -133,6 +546,36 @@ constexpr uint8_t Convert6To8(uint8_t v)
 	// Swizzle bits: 00123456 -> 12345612
 	return (v << 2) | (v >> 4);
 }
+static inline uint32_t DecodePixel_I(uint8_t i)
+{
+	return i | (i << 8) | (i << 16) | (i << 24);
+}
+
+static inline uint32_t DecodePixel_IA(uint8_t i, uint8_t a)
+{
+	return i | (i << 8) | (i << 16) | (a << 24);
+}
+
+static inline uint32_t DecodePixel_RGB5A3(uint16_t val)
+{
+	int r,g,b,a;
+	if ((val & 0x8000))
+	{
+		r=Convert5To8((val>>10) & 0x1f);
+		g=Convert5To8((val>>5 ) & 0x1f);
+		b=Convert5To8((val    ) & 0x1f);
+		a=0xFF;
+	}
+	else
+	{
+		a=Convert3To8((val>>12) & 0x7);
+		r=Convert4To8((val>>8 ) & 0xf);
+		g=Convert4To8((val>>4 ) & 0xf);
+		b=Convert4To8((val    ) & 0xf);
+	}
+	return r | (g<<8) | (b << 16) | (a << 24);
+}
+
 static inline uint32_t DecodePixel_RGB565(uint16_t val)
 {
 	int r,g,b,a;
@@ -142,26 +585,172 @@ static inline uint32_t DecodePixel_RGB565(uint16_t val)
 	a=0xFF;
 	return  r | (g<<8) | (b << 16) | (a << 24);
 }
+static inline uint32_t MakeRGBA(int r, int g, int b, int a)
+{
+	return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+static inline int DXTBlend(int v1, int v2)
+{
+	// 3/8 blend, which is what the hardware does
+	return ((v1 * 3 + v2 * 5) >> 3);
+}
+
+static void DecodeDXTBlock(uint32_t* dst, const uint8_t* src, int width)
+{
+	uint16_t c1 = (src[0] << 8) | src[1];
+	uint16_t c2 = (src[2] << 8) | src[3];
+	int blue1 = Convert5To8(c1 & 0x1F);
+	int blue2 = Convert5To8(c2 & 0x1F);
+	int green1 = Convert6To8((c1 >> 5) & 0x3F);
+	int green2 = Convert6To8((c2 >> 5) & 0x3F);
+	int red1 = Convert5To8((c1 >> 11) & 0x1F);
+	int red2 = Convert5To8((c2 >> 11) & 0x1F);
+
+	uint32_t colors[4];
+	colors[0] = MakeRGBA(red1, green1, blue1, 255);
+	colors[1] = MakeRGBA(red2, green2, blue2, 255);
+	if (c1 > c2)
+	{
+		colors[2] = MakeRGBA(DXTBlend(red2, red1), DXTBlend(green2, green1), DXTBlend(blue2, blue1), 255);
+		colors[3] = MakeRGBA(DXTBlend(red1, red2), DXTBlend(green1, green2), DXTBlend(blue1, blue2), 255);
+	}
+	else
+	{
+		// colors[3] is the same as colors[2], the average of both, but transparent
+		colors[2] = MakeRGBA((red1 + red2 + 1) / 2, (green1 + green2 + 1) / 2, (blue1 + blue2 + 1) / 2, 255);
+		colors[3] = MakeRGBA((red1 + red2 + 1) / 2, (green1 + green2 + 1) / 2, (blue1 + blue2 + 1) / 2, 0);
+	}
+
+	for (int y = 0; y < 4; y++, dst += width)
+	{
+		int val = src[4 + y];
+		for (int x = 0; x < 4; x++, val <<= 2)
+			dst[x] = colors[(val >> 6) & 3];
+	}
+}
+
+static inline uint32_t DecodeTLUTEntry(const uint8_t* tlut, int index, TlutFormat fmt)
+{
+	const uint8_t* entry = tlut + 2 * index;
+	switch(fmt)
+	{
+	case TlutFormat::IA8:
+		return DecodePixel_IA(entry[1], entry[0]);
+	case TlutFormat::RGB565:
+		return DecodePixel_RGB565((entry[0] << 8) | entry[1]);
+	default:
+		return DecodePixel_RGB5A3((entry[0] << 8) | entry[1]);
+	}
+}
+
+static void ExpandTLUT(uint32_t* dst, const uint8_t* tlut, int entries, TlutFormat fmt)
+{
+	for (int i = 0; i < entries; i++)
+		dst[i] = DecodeTLUTEntry(tlut, i, fmt);
+}
+
+// Walks the tiles of a paletted format and stores lookup(index) for every texel
+template<typename T, typename Lookup>
+static void DecodePaletted(T* dst, const uint8_t* src, int width, int height, TexType type, Lookup lookup)
+{
+	switch(type)
+	{
+	case TexType::TYPE_C4:
+		for (int y = 0; y < height; y += 8)
+			for (int x = 0; x < width; x += 8)
+				for (int iy = 0; iy < 8; iy++, src += 4)
+				{
+					T *ptr = dst + (y + iy) * width + x;
+					for (int j = 0; j < 4; j++)
+					{
+						*ptr++ = lookup(src[j] >> 4);
+						*ptr++ = lookup(src[j] & 0xF);
+					}
+				}
+	break;
+	case TexType::TYPE_C8:
+		for (int y = 0; y < height; y += 4)
+			for (int x = 0; x < width; x += 8)
+				for (int iy = 0; iy < 4; iy++, src += 8)
+				{
+					T *ptr = dst + (y + iy) * width + x;
+					for (int j = 0; j < 8; j++)
+						*ptr++ = lookup(src[j]);
+				}
+	break;
+	case TexType::TYPE_C14X2:
+		for (int y = 0; y < height; y += 4)
+			for (int x = 0; x < width; x += 4)
+				for (int iy = 0; iy < 4; iy++, src += 8)
+				{
+					T *ptr = dst + (y + iy) * width + x;
+					for (int j = 0; j < 4; j++)
+						*ptr++ = lookup(((src[2 * j] << 8) | src[2 * j + 1]) & 0x3FFF);
+				}
+	break;
+	default:
+	break;
+	}
+}
+
 #include <byteswap.h>
 
 inline uint16_t swap16(uint16_t _data) {return bswap_16(_data);}
 inline uint32_t swap32(uint32_t _data) {return bswap_32(_data);}
 inline uint64_t swap64(uint64_t _data) {return bswap_64(_data);}
 
-template<bool SSE>
-void DecodeOnCPU(uint32_t* dst, uint8_t* src, int width, int height, TexType type)
+void DecodeOnCPU_C(uint32_t* dst, uint8_t* src, int width, int height, TexType type,
+                   const uint8_t* tlut, TlutFormat tlut_fmt)
 {
-	if (SSE)
-	{
-		DecodeOnCPU_SSE(dst, src, width, height, type);
-		return;
-	}
-
 	const int Wsteps4 = (width + 3) / 4;
 	const int Wsteps8 = (width + 7) / 8;
 
 	switch(type)
 	{
+	case TexType::TYPE_I4:
+		for (int y = 0; y < height; y += 8)
+			for (int x = 0; x < width; x += 8)
+				for (int iy = 0; iy < 8; iy++, src += 4)
+				{
+					uint32_t *ptr = dst + (y + iy) * width + x;
+					for (int j = 0; j < 4; j++)
+					{
+						*ptr++ = DecodePixel_I(Convert4To8(src[j] >> 4));
+						*ptr++ = DecodePixel_I(Convert4To8(src[j] & 0xF));
+					}
+				}
+	break;
+	case TexType::TYPE_I8:
+		for (int y = 0; y < height; y += 4)
+			for (int x = 0; x < width; x += 8)
+				for (int iy = 0; iy < 4; iy++, src += 8)
+				{
+					uint32_t *ptr = dst + (y + iy) * width + x;
+					for (int j = 0; j < 8; j++)
+						*ptr++ = DecodePixel_I(src[j]);
+				}
+	break;
+	case TexType::TYPE_IA4:
+		for (int y = 0; y < height; y += 4)
+			for (int x = 0; x < width; x += 8)
+				for (int iy = 0; iy < 4; iy++, src += 8)
+				{
+					uint32_t *ptr = dst + (y + iy) * width + x;
+					for (int j = 0; j < 8; j++)
+						*ptr++ = DecodePixel_IA(Convert4To8(src[j] & 0xF), Convert4To8(src[j] >> 4));
+				}
+	break;
+	case TexType::TYPE_IA8:
+		for (int y = 0; y < height; y += 4)
+			for (int x = 0; x < width; x += 4)
+				for (int iy = 0; iy < 4; iy++, src += 8)
+				{
+					uint32_t *ptr = dst + (y + iy) * width + x;
+					for (int j = 0; j < 4; j++)
+						*ptr++ = DecodePixel_IA(src[2 * j + 1], src[2 * j]);
+				}
+	break;
 	case TexType::TYPE_RGB565:
 		// Reference C implementation.
 		for (int y = 0; y < height; y += 4)
@@ -174,8 +763,566 @@ void DecodeOnCPU(uint32_t* dst, uint8_t* src, int width, int height, TexType typ
 						*ptr++ = DecodePixel_RGB565(swap16(*s++));
 				}
 	break;
+	case TexType::TYPE_RGB5A3:
+		for (int y = 0; y < height; y += 4)
+			for (int x = 0; x < width; x += 4)
+				for (int iy = 0; iy < 4; iy++, src += 8)
+				{
+					uint32_t *ptr = dst + (y + iy) * width + x;
+					uint16_t *s = (uint16_t *)src;
+					for (int j = 0; j < 4; j++)
+						*ptr++ = DecodePixel_RGB5A3(swap16(*s++));
+				}
+	break;
+	case TexType::TYPE_RGBA8:
+		for (int y = 0; y < height; y += 4)
+			for (int x = 0; x < width; x += 4, src += 64)
+				for (int iy = 0; iy < 4; iy++)
+				{
+					uint32_t *ptr = dst + (y + iy) * width + x;
+					const uint8_t *ar = src + 8 * iy;
+					const uint8_t *gb = src + 32 + 8 * iy;
+					for (int j = 0; j < 4; j++)
+						*ptr++ = ar[2 * j + 1] | (gb[2 * j] << 8) | (gb[2 * j + 1] << 16) | (ar[2 * j] << 24);
+				}
+	break;
+	case TexType::TYPE_CMPR:
+		for (int y = 0; y < height; y += 8)
+			for (int x = 0; x < width; x += 8, src += 32)
+			{
+				uint32_t *ptr = dst + y * width + x;
+				DecodeDXTBlock(ptr, src, width);
+				DecodeDXTBlock(ptr + 4, src + 8, width);
+				DecodeDXTBlock(ptr + 4 * width, src + 16, width);
+				DecodeDXTBlock(ptr + 4 * width + 4, src + 24, width);
+			}
+	break;
+	case TexType::TYPE_C4:
+	case TexType::TYPE_C8:
+	case TexType::TYPE_C14X2:
+		DecodePaletted(dst, src, width, height, type,
+			[=](int index) { return DecodeTLUTEntry(tlut, index, tlut_fmt); });
+	break;
+	default:
+	break;
+	}
+}
+
+const char* GetCPUKernelName(CPUKernel kernel)
+{
+	switch(kernel)
+	{
+	case CPUKernel::SCALAR: return "C";
+	case CPUKernel::SSE2: return "SSE2";
+	case CPUKernel::AVX2: return "AVX2";
+	case CPUKernel::AVX512: return "AVX512";
+	default: return "?";
+	}
+}
+
+bool IsCPUKernelSupported(CPUKernel kernel)
+{
+	switch(kernel)
+	{
+	case CPUKernel::SCALAR: return true;
+	case CPUKernel::SSE2: return cpu_info.bSSE2;
+	case CPUKernel::AVX2: return cpu_info.bAVX2;
+	case CPUKernel::AVX512: return cpu_info.bAVX512;
+	default: return false;
+	}
+}
+
+CPUKernel GetBestCPUKernel()
+{
+	static const CPUKernel best = []
+	{
+		CPUKernel kernel = CPUKernel::SCALAR;
+		for (int i = 0; i < (int)CPUKernel::COUNT; ++i)
+			if (IsCPUKernelSupported((CPUKernel)i))
+				kernel = (CPUKernel)i;
+		return kernel;
+	}();
+	return best;
+}
+
+// The vector kernels share one paletted path: the TLUT is decoded once up front and
+// every texel is a table load, which beats gathers at every width we have.
+static void DecodePalettedExpanded(uint32_t* dst, const uint8_t* src, int width, int height, TexType type,
+                                   const uint32_t* palette)
+{
+	DecodePaletted(dst, src, width, height, type, [=](int index) { return palette[index]; });
+}
+
+void DecodeOnCPU(CPUKernel kernel, uint32_t* dst, uint8_t* src, int width, int height, TexType type,
+                 const uint8_t* tlut, TlutFormat tlut_fmt)
+{
+	if (IsPaletted(type) && kernel != CPUKernel::SCALAR)
+	{
+		std::vector<uint32_t> palette(GetPaletteSize(type));
+		ExpandTLUT(&palette[0], tlut, palette.size(), tlut_fmt);
+		DecodePalettedExpanded(dst, src, width, height, type, &palette[0]);
+		return;
+	}
+
+	switch(kernel)
+	{
+	case CPUKernel::SSE2: DecodeOnCPU_SSE(dst, src, width, height, type); break;
+	case CPUKernel::AVX2: DecodeOnCPU_AVX2(dst, src, width, height, type); break;
+	case CPUKernel::AVX512: DecodeOnCPU_AVX512(dst, src, width, height, type); break;
+	default: DecodeOnCPU_C(dst, src, width, height, type, tlut, tlut_fmt); break;
+	}
+}
+
+void DecodeIndicesOnCPU(uint16_t* dst, const uint8_t* src, int width, int height, TexType type)
+{
+	DecodePaletted(dst, src, width, height, type, [](int index) { return (uint16_t)index; });
+}
+
+void ApplyTLUTOnCPU(uint32_t* dst, const uint16_t* indices, int count, const uint8_t* tlut, int entries, TlutFormat tlut_fmt)
+{
+	std::vector<uint32_t> palette(entries);
+	ExpandTLUT(&palette[0], tlut, entries, tlut_fmt);
+	for (int i = 0; i < count; i++)
+		dst[i] = palette[indices[i]];
+}
+
+static inline uint8_t ReverseDXTIndices(uint8_t val)
+{
+	// 0bAABBCCDD -> 0bDDCCBBAA
+	val = ((val & 0x33) << 2) | ((val >> 2) & 0x33);
+	return (val << 4) | (val >> 4);
+}
+
+// Two sub-blocks at once, endpoints byte swapped and index bytes mirrored
+static inline __m128i TranscodeDXTx2_SSE(__m128i blocks)
+{
+	const __m128i kMask2 = _mm_set1_epi8(0x33);
+	const __m128i kMask4 = _mm_set1_epi8(0x0F);
+	const __m128i kEndpoints = _mm_setr_epi16(-1, -1, 0, 0, -1, -1, 0, 0);
+
+	const __m128i swapped = _mm_or_si128(_mm_slli_epi16(blocks, 8), _mm_srli_epi16(blocks, 8));
+
+	__m128i mirrored = _mm_or_si128(
+		_mm_slli_epi16(_mm_and_si128(blocks, kMask2), 2),
+		_mm_and_si128(_mm_srli_epi16(blocks, 2), kMask2));
+	mirrored = _mm_or_si128(
+		_mm_slli_epi16(_mm_and_si128(mirrored, kMask4), 4),
+		_mm_and_si128(_mm_srli_epi16(mirrored, 4), kMask4));
+
+	return _mm_or_si128(_mm_and_si128(kEndpoints, swapped), _mm_andnot_si128(kEndpoints, mirrored));
+}
+
+// A tile row of the rect is a contiguous run of tiles, so each one is decoded as a texture
+// of its own into scratch and copied to its place in dst
+template<typename T, typename Decode>
+static void DecodeTileRows(T* dst, uint8_t* src, int width, int height, TexType type,
+                           int x, int y, int w, int h, Decode decode)
+{
+	const TexInfo info = GetTexInfo(type);
+	const int tiles_w = (width + info.block_w - 1) / info.block_w;
+	const int tiles_h = (height + info.block_h - 1) / info.block_h;
+	const int x0 = std::max(x, 0) / info.block_w;
+	const int x1 = std::min((x + w + info.block_w - 1) / info.block_w, tiles_w);
+	const int y0 = std::max(y, 0) / info.block_h;
+	const int y1 = std::min((y + h + info.block_h - 1) / info.block_h, tiles_h);
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	const int run_w = (x1 - x0) * info.block_w;
+	const int copy_w = std::min(run_w, width - x0 * info.block_w);
+	std::vector<T> scratch((size_t)run_w * info.block_h);
+	for (int ty = y0; ty < y1; ++ty)
+	{
+		decode(&scratch[0], src + ((size_t)ty * tiles_w + x0) * info.block_bytes, run_w, info.block_h);
+		const int rows = std::min(info.block_h, height - ty * info.block_h);
+		for (int iy = 0; iy < rows; ++iy)
+			memcpy(dst + (size_t)(ty * info.block_h + iy) * width + x0 * info.block_w,
+			       &scratch[(size_t)iy * run_w], copy_w * sizeof(T));
+	}
+}
+
+void DecodeRectOnCPU(CPUKernel kernel, uint32_t* dst, uint8_t* src, int width, int height, TexType type,
+                     int x, int y, int w, int h, const uint8_t* tlut, TlutFormat tlut_fmt)
+{
+	// Expanded once rather than for every tile row
+	if (IsPaletted(type) && kernel != CPUKernel::SCALAR)
+	{
+		std::vector<uint32_t> palette(GetPaletteSize(type));
+		ExpandTLUT(&palette[0], tlut, palette.size(), tlut_fmt);
+		DecodeTileRows(dst, src, width, height, type, x, y, w, h,
+			[&](uint32_t* run_dst, uint8_t* run_src, int run_w, int run_h)
+			{
+				DecodePalettedExpanded(run_dst, run_src, run_w, run_h, type, &palette[0]);
+			});
+		return;
+	}
+
+	DecodeTileRows(dst, src, width, height, type, x, y, w, h,
+		[&](uint32_t* run_dst, uint8_t* run_src, int run_w, int run_h)
+		{
+			DecodeOnCPU(kernel, run_dst, run_src, run_w, run_h, type, tlut, tlut_fmt);
+		});
+}
+
+void DecodeIndicesRectOnCPU(uint16_t* dst, uint8_t* src, int width, int height, TexType type, int x, int y, int w, int h)
+{
+	DecodeTileRows(dst, src, width, height, type, x, y, w, h,
+		[&](uint16_t* run_dst, uint8_t* run_src, int run_w, int run_h)
+		{
+			DecodeIndicesOnCPU(run_dst, run_src, run_w, run_h, type);
+		});
+}
+
+// Any size, with the TLUT already expanded when palette isn't null.
+// The kernels only take whole tiles, partial ones go through the rect scratch.
+static void DecodeAnySize(CPUKernel kernel, uint32_t* dst, uint8_t* src, int width, int height, TexType type,
+                          const uint8_t* tlut, TlutFormat tlut_fmt, const uint32_t* palette)
+{
+	const TexInfo info = GetTexInfo(type);
+	if (width % info.block_w || height % info.block_h)
+		DecodeRectOnCPU(kernel, dst, src, width, height, type, 0, 0, width, height, tlut, tlut_fmt);
+	else if (palette)
+		DecodePalettedExpanded(dst, src, width, height, type, palette);
+	else
+		DecodeOnCPU(kernel, dst, src, width, height, type, tlut, tlut_fmt);
+}
+
+// Null for the scalar kernel, which has its own TLUT path
+static std::vector<uint32_t> ExpandTLUTForKernel(CPUKernel kernel, TexType type, const uint8_t* tlut, TlutFormat tlut_fmt)
+{
+	std::vector<uint32_t> palette;
+	if (IsPaletted(type) && kernel != CPUKernel::SCALAR)
+	{
+		palette.resize(GetPaletteSize(type));
+		ExpandTLUT(&palette[0], tlut, palette.size(), tlut_fmt);
+	}
+	return palette;
+}
+
+void DecodeMipChainOnCPU(CPUKernel kernel, uint32_t* dst, uint8_t* src, int width, int height, int levels,
+                         TexType type, const uint8_t* tlut, TlutFormat tlut_fmt)
+{
+	const std::vector<uint32_t> palette = ExpandTLUTForKernel(kernel, type, tlut, tlut_fmt);
+	for (int level = 0; level < levels; ++level)
+	{
+		const int w = GetMipSize(width, level), h = GetMipSize(height, level);
+		DecodeAnySize(kernel, dst, src, w, h, type, tlut, tlut_fmt, palette.empty() ? nullptr : &palette[0]);
+		dst += (size_t)w * h;
+		src += GetEncodedSize(type, w, h);
+	}
+}
+
+void TranscodeCMPRToBC1(CPUKernel kernel, uint8_t* dst, const uint8_t* src, int width, int height)
+{
+	const int Wsteps8 = (width + 7) / 8;
+	// BC1 blocks per row and column. Tiles are 8x8, so with a width or height that isn't a multiple
+	// of 8 the right or bottom sub-blocks of the last tiles fall outside and are skipped.
+	const int pitch = (width + 3) / 4;
+	const int rows = (height + 3) / 4;
+
+	// The top and bottom sub-block pairs of a tile land in consecutive block rows
+	if (kernel == CPUKernel::SCALAR)
+	{
+		for (int y = 0; y < height; y += 8)
+			for (int x = 0; x < width; x += 8)
+				for (int sub = 0; sub < 4; sub++, src += 8)
+				{
+					const int bx = (x / 4) + (sub & 1), by = (y / 4) + (sub >> 1);
+					if (bx >= pitch || by >= rows)
+						continue;
+					uint8_t *block = dst + (by * pitch + bx) * 8;
+					block[0] = src[1];
+					block[1] = src[0];
+					block[2] = src[3];
+					block[3] = src[2];
+					for (int j = 4; j < 8; j++)
+						block[j] = ReverseDXTIndices(src[j]);
+				}
+		return;
+	}
+
+	for (int y = 0; y < height; y += 8)
+		for (int x = 0, yStep = (y / 8) * Wsteps8; x < width; x += 8, yStep++)
+		{
+			const __m128i* tile = (const __m128i*)(src + 32 * yStep);
+			const int bx = x / 4;
+			for (int half = 0; half < 2 && y / 4 + half < rows; ++half)
+			{
+				const __m128i pair = TranscodeDXTx2_SSE(_mm_loadu_si128(tile + half));
+				uint8_t* block = dst + ((y / 4 + half) * pitch + bx) * 8;
+				// Both blocks, or only the left one on the last tile of an odd number of block columns
+				if (bx + 1 < pitch)
+					_mm_storeu_si128((__m128i*)block, pair);
+				else
+					_mm_storel_epi64((__m128i*)block, pair);
+			}
+		}
+}
+
+// One tile row at a time, clipped to width x height so partial tiles work too
+static void DecodeNarrow_C(uint8_t* dst, const uint8_t* src, int width, int height, TexType type)
+{
+	const TexInfo info = GetTexInfo(type);
+	const int texel_bytes = GetDecodedTexelBytes(GetNarrowFormat(type));
+	const int pitch = GetDecodedPitch(GetNarrowFormat(type), width);
+	const int row_bytes = info.block_bytes / info.block_h;
+
+	for (int y = 0; y < height; y += info.block_h)
+		for (int x = 0; x < width; x += info.block_w)
+			for (int iy = 0; iy < info.block_h; iy++, src += row_bytes)
+			{
+				if (y + iy >= height)
+					continue;
+				uint8_t *ptr = dst + (size_t)(y + iy) * pitch + x * texel_bytes;
+				const int texels = std::min(info.block_w, width - x);
+				switch(type)
+				{
+				case TexType::TYPE_I4:
+					for (int j = 0; j < texels; j++)
+						ptr[j] = Convert4To8(j & 1 ? src[j / 2] & 0xF : src[j / 2] >> 4);
+				break;
+				case TexType::TYPE_I8:
+					memcpy(ptr, src, texels);
+				break;
+				case TexType::TYPE_IA4:
+					for (int j = 0; j < texels; j++)
+					{
+						ptr[2 * j] = Convert4To8(src[j] & 0xF);
+						ptr[2 * j + 1] = Convert4To8(src[j] >> 4);
+					}
+				break;
+				// AI to IA, and big-endian RGB565 to native
+				case TexType::TYPE_IA8:
+				case TexType::TYPE_RGB565:
+					for (int j = 0; j < texels; j++)
+					{
+						ptr[2 * j] = src[2 * j + 1];
+						ptr[2 * j + 1] = src[2 * j];
+					}
+				break;
+				default:
+				break;
+				}
+			}
+}
+
+// Whole tiles only, each one as two halves of 16 bytes
+static void DecodeNarrow_SSE(uint8_t* dst, const uint8_t* src, int width, int height, TexType type)
+{
+	const TexInfo info = GetTexInfo(type);
+	const int texel_bytes = GetDecodedTexelBytes(GetNarrowFormat(type));
+	const int pitch = GetDecodedPitch(GetNarrowFormat(type), width);
+	const __m128i kMask4 = _mm_set1_epi8(0x0F);
+
+	for (int y = 0; y < height; y += info.block_h)
+		for (int x = 0; x < width; x += info.block_w, src += info.block_bytes)
+			for (int half = 0; half < 2; half++)
+			{
+				const __m128i v = _mm_loadu_si128((const __m128i*)src + half);
+				uint8_t *row = dst + (size_t)(y + half * info.block_h / 2) * pitch + x * texel_bytes;
+				switch(type)
+				{
+				case TexType::TYPE_I4:
+				{
+					// Four rows of eight, the high nibble first
+					const __m128i hi = Convert4To8x16_SSE(_mm_and_si128(_mm_srli_epi16(v, 4), kMask4));
+					const __m128i lo = Convert4To8x16_SSE(_mm_and_si128(v, kMask4));
+					const __m128i rows01 = _mm_unpacklo_epi8(hi, lo);
+					const __m128i rows23 = _mm_unpackhi_epi8(hi, lo);
+					_mm_storel_epi64((__m128i*)row, rows01);
+					_mm_storel_epi64((__m128i*)(row + pitch), _mm_srli_si128(rows01, 8));
+					_mm_storel_epi64((__m128i*)(row + 2 * pitch), rows23);
+					_mm_storel_epi64((__m128i*)(row + 3 * pitch), _mm_srli_si128(rows23, 8));
+				}
+				break;
+				case TexType::TYPE_I8:
+					_mm_storel_epi64((__m128i*)row, v);
+					_mm_storel_epi64((__m128i*)(row + pitch), _mm_srli_si128(v, 8));
+				break;
+				case TexType::TYPE_IA4:
+				{
+					// Two rows of eight, alpha in the high nibble
+					const __m128i a = Convert4To8x16_SSE(_mm_and_si128(_mm_srli_epi16(v, 4), kMask4));
+					const __m128i i = Convert4To8x16_SSE(_mm_and_si128(v, kMask4));
+					_mm_storeu_si128((__m128i*)row, _mm_unpacklo_epi8(i, a));
+					_mm_storeu_si128((__m128i*)(row + pitch), _mm_unpackhi_epi8(i, a));
+				}
+				break;
+				case TexType::TYPE_IA8:
+				case TexType::TYPE_RGB565:
+				{
+					// Two rows of four byte swapped texels
+					const __m128i swapped = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+					_mm_storel_epi64((__m128i*)row, swapped);
+					_mm_storel_epi64((__m128i*)(row + pitch), _mm_srli_si128(swapped, 8));
+				}
+				break;
+				default:
+				break;
+				}
+			}
+}
+
+void DecodeNarrowOnCPU(CPUKernel kernel, uint8_t* dst, const uint8_t* src, int width, int height, TexType type)
+{
+	const TexInfo info = GetTexInfo(type);
+	if (GetNarrowFormat(type) == DecodedFormat::RGBA8)
+		return;
+	if (kernel == CPUKernel::SCALAR || width % info.block_w || height % info.block_h)
+		DecodeNarrow_C(dst, src, width, height, type);
+	else
+		DecodeNarrow_SSE(dst, src, width, height, type);
+}
+
+template<bool SSE>
+void DecodeOnCPU(uint32_t* dst, uint8_t* src, int width, int height, TexType type,
+                 const uint8_t* tlut, TlutFormat tlut_fmt)
+{
+	DecodeOnCPU(SSE ? GetBestCPUKernel() : CPUKernel::SCALAR, dst, src, width, height, type, tlut, tlut_fmt);
+}
+
+template void DecodeOnCPU<true>(uint32_t*, uint8_t*, int, int, TexType, const uint8_t*, TlutFormat);
+template void DecodeOnCPU<false>(uint32_t*, uint8_t*, int, int, TexType, const uint8_t*, TlutFormat);
+
+static std::unique_ptr<ThreadPool> s_pool;
+static int s_num_threads = 0;
+static int s_min_band_texels = 256 * 256;
+
+void SetDecodeThreadCount(int threads)
+{
+	if (threads <= 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	if (s_pool && s_num_threads == threads)
+		return;
+
+	s_num_threads = threads;
+	s_pool.reset(new ThreadPool(threads));
+}
+
+int GetDecodeThreadCount()
+{
+	if (!s_pool)
+		SetDecodeThreadCount(0);
+	return s_num_threads;
+}
+
+void SetDecodeMinBandTexels(int texels)
+{
+	s_min_band_texels = std::max(1, texels);
+}
+
+void DecodeOnCPUParallel(CPUKernel kernel, uint32_t* dst, uint8_t* src, int width, int height, TexType type,
+                         const uint8_t* tlut, TlutFormat tlut_fmt)
+{
+	const TexInfo info = GetTexInfo(type);
+	const int block_rows = (height + info.block_h - 1) / info.block_h;
+	const int row_texels = width * info.block_h;
+	const int row_bytes = GetEncodedSize(type, width, info.block_h);
+
+	const int max_bands = std::max(1, (block_rows * row_texels) / s_min_band_texels);
+	const int bands = std::min(std::min(GetDecodeThreadCount(), max_bands), block_rows);
+	if (bands <= 1)
+	{
+		DecodeAnySize(kernel, dst, src, width, height, type, tlut, tlut_fmt, nullptr);
+		return;
 	}
+
+	// Expand the TLUT once rather than per band
+	std::vector<uint32_t> palette;
+	if (IsPaletted(type) && kernel != CPUKernel::SCALAR)
+	{
+		palette.resize(GetPaletteSize(type));
+		ExpandTLUT(&palette[0], tlut, palette.size(), tlut_fmt);
+	}
+
+	s_pool->Run(bands, [&](int band)
+	{
+		const int first_row = block_rows * band / bands;
+		const int last_row = block_rows * (band + 1) / bands;
+		const int y = first_row * info.block_h;
+		const int band_h = std::min(last_row * info.block_h, height) - y;
+
+		// Only the last band can end in a partial tile row, any band can have a partial tile column
+		DecodeAnySize(kernel, dst + (size_t)y * width, src + (size_t)first_row * row_bytes, width, band_h, type,
+			tlut, tlut_fmt, palette.empty() ? nullptr : &palette[0]);
+	});
+}
+
+void DecodeBatchOnCPU(CPUKernel kernel, const CPUDecodeJob* jobs, int count, TexType type,
+                      const uint8_t* tlut, TlutFormat tlut_fmt)
+{
+	const std::vector<uint32_t> palette = ExpandTLUTForKernel(kernel, type, tlut, tlut_fmt);
+	for (int i = 0; i < count; ++i)
+		DecodeAnySize(kernel, jobs[i].dst, jobs[i].src, jobs[i].width, jobs[i].height, type,
+			tlut, tlut_fmt, palette.empty() ? nullptr : &palette[0]);
+}
+
+void DecodeBatchOnCPUParallel(CPUKernel kernel, const CPUDecodeJob* jobs, int count, TexType type,
+                              const uint8_t* tlut, TlutFormat tlut_fmt)
+{
+	int64_t texels = 0;
+	for (int i = 0; i < count; ++i)
+		texels += (int64_t)jobs[i].width * jobs[i].height;
+
+	// Contiguous runs of jobs, balanced by texel count
+	const int bands = (int)std::min<int64_t>(std::min(GetDecodeThreadCount(), count),
+		std::max<int64_t>(1, texels / s_min_band_texels));
+	if (bands <= 1)
+	{
+		DecodeBatchOnCPU(kernel, jobs, count, type, tlut, tlut_fmt);
+		return;
+	}
+
+	const std::vector<uint32_t> palette = ExpandTLUTForKernel(kernel, type, tlut, tlut_fmt);
+	std::vector<int> first_job(bands + 1, count);
+	int64_t sum = 0;
+	for (int i = 0, band = 0; i < count; ++i)
+	{
+		while (band < bands && sum >= texels * band / bands)
+			first_job[band++] = i;
+		sum += (int64_t)jobs[i].width * jobs[i].height;
+	}
+
+	s_pool->Run(bands, [&](int band)
+	{
+		for (int i = first_job[band]; i < first_job[band + 1]; ++i)
+			DecodeAnySize(kernel, jobs[i].dst, jobs[i].src, jobs[i].width, jobs[i].height, type,
+				tlut, tlut_fmt, palette.empty() ? nullptr : &palette[0]);
+	});
+}
+
+void DecodeNarrowOnCPUParallel(CPUKernel kernel, uint8_t* dst, const uint8_t* src, int width, int height, TexType type)
+{
+	const TexInfo info = GetTexInfo(type);
+	const int block_rows = (height + info.block_h - 1) / info.block_h;
+	const int row_bytes = GetEncodedSize(type, width, info.block_h);
+	const int pitch = GetDecodedPitch(GetNarrowFormat(type), width);
+
+	const int max_bands = std::max(1, (block_rows * width * info.block_h) / s_min_band_texels);
+	const int bands = std::min(std::min(GetDecodeThreadCount(), max_bands), block_rows);
+	if (bands <= 1)
+	{
+		DecodeNarrowOnCPU(kernel, dst, src, width, height, type);
+		return;
+	}
+
+	s_pool->Run(bands, [&](int band)
+	{
+		const int first_row = block_rows * band / bands;
+		const int last_row = block_rows * (band + 1) / bands;
+		const int y = first_row * info.block_h;
+		DecodeNarrowOnCPU(kernel, dst + (size_t)y * pitch, src + first_row * row_bytes, width,
+			std::min(last_row * info.block_h, height) - y, type);
+	});
+}
+
+template<bool SSE>
+void DecodeOnCPUParallel(uint32_t* dst, uint8_t* src, int width, int height, TexType type,
+                         const uint8_t* tlut, TlutFormat tlut_fmt)
+{
+	DecodeOnCPUParallel(SSE ? GetBestCPUKernel() : CPUKernel::SCALAR, dst, src, width, height, type, tlut, tlut_fmt);
 }
 
-template void DecodeOnCPU<true>(uint32_t*, uint8_t*, int, int, TexType);
-template void DecodeOnCPU<false>(uint32_t*, uint8_t*, int, int, TexType);
+template void DecodeOnCPUParallel<true>(uint32_t*, uint8_t*, int, int, TexType, const uint8_t*, TlutFormat);
+template void DecodeOnCPUParallel<false>(uint32_t*, uint8_t*, int, int, TexType, const uint8_t*, TlutFormat);
@@ -1,7 +1,90 @@
 #pragma once
 
+#include <stdint.h>
+
 #include "DecodeTypes.h"
 
+// Decode kernels, narrowest to widest
+enum class CPUKernel
+{
+	SCALAR,
+	SSE2,
+	AVX2,
+	AVX512,
+	COUNT,
+};
+
+const char* GetCPUKernelName(CPUKernel kernel);
+bool IsCPUKernelSupported(CPUKernel kernel);
+// Widest kernel the host supports, checked with cpuid on first use
+CPUKernel GetBestCPUKernel();
+
+// Formats without a kernel at the requested width use the next narrower one.
+// Paletted formats need tlut, GetPaletteSize(type) entries in tlut_fmt; other formats ignore it.
+// DecodeOnCPU only takes whole tiles, width and height multiples of the block size; DecodeRectOnCPU
+// and DecodeOnCPUParallel take any size.
+void DecodeOnCPU(CPUKernel kernel, uint32_t* dst, uint8_t* src, int width, int height, TexType type,
+                 const uint8_t* tlut = nullptr, TlutFormat tlut_fmt = TlutFormat::IA8);
+void DecodeOnCPUParallel(CPUKernel kernel, uint32_t* dst, uint8_t* src, int width, int height, TexType type,
+                         const uint8_t* tlut = nullptr, TlutFormat tlut_fmt = TlutFormat::IA8);
+
+// Deferred TLUT: untile the indices of a paletted format once into a linear width * height image,
+// then run ApplyTLUTOnCPU on them whenever only the palette changes.
+void DecodeIndicesOnCPU(uint16_t* dst, const uint8_t* src, int width, int height, TexType type);
+void ApplyTLUTOnCPU(uint32_t* dst, const uint16_t* indices, int count, const uint8_t* tlut, int entries, TlutFormat tlut_fmt);
+
+// Only the tiles covering the texel rect x, y, w, h, written to their place in the whole
+// width * height dst. Cost scales with the rect rather than the texture.
+void DecodeRectOnCPU(CPUKernel kernel, uint32_t* dst, uint8_t* src, int width, int height, TexType type,
+                     int x, int y, int w, int h, const uint8_t* tlut = nullptr, TlutFormat tlut_fmt = TlutFormat::IA8);
+void DecodeIndicesRectOnCPU(uint16_t* dst, uint8_t* src, int width, int height, TexType type, int x, int y, int w, int h);
+
+// Every level of a mip chain stored as GetMipChainEncodedSize describes, into dst level after
+// level, each GetMipSize(width, level) * GetMipSize(height, level) texels. Levels smaller than
+// a tile still take a whole one in src.
+void DecodeMipChainOnCPU(CPUKernel kernel, uint32_t* dst, uint8_t* src, int width, int height, int levels,
+                         TexType type, const uint8_t* tlut = nullptr, TlutFormat tlut_fmt = TlutFormat::IA8);
+
+// One texture of a batch, dst holds width * height texels
+struct CPUDecodeJob
+{
+	uint32_t* dst;
+	uint8_t* src;
+	int width, height;
+};
+
+// Same-format textures of any size in one call, the TLUT expanded once for all of them.
+// The parallel version hands whole textures to the threads rather than bands of each.
+void DecodeBatchOnCPU(CPUKernel kernel, const CPUDecodeJob* jobs, int count, TexType type,
+                      const uint8_t* tlut = nullptr, TlutFormat tlut_fmt = TlutFormat::IA8);
+void DecodeBatchOnCPUParallel(CPUKernel kernel, const CPUDecodeJob* jobs, int count, TexType type,
+                              const uint8_t* tlut = nullptr, TlutFormat tlut_fmt = TlutFormat::IA8);
+
+// Rewrites CMPR tiles as BC1/DXT1 blocks in linear block order without decoding them.
+// CMPR is BC1 with big-endian endpoints and mirrored index bits, so this is a byte shuffle.
+// dst needs ((width + 3) / 4) * ((height + 3) / 4) * 8 bytes.
+void TranscodeCMPRToBC1(CPUKernel kernel, uint8_t* dst, const uint8_t* src, int width, int height);
+
+// Narrow output for the formats GetNarrowFormat has a narrow format for, into rows of GetDecodedPitch
+// bytes. It's only an untile with a nibble expand or byte swap, so no kernel is wider than SSE2.
+// Other formats are left alone.
+void DecodeNarrowOnCPU(CPUKernel kernel, uint8_t* dst, const uint8_t* src, int width, int height, TexType type);
+void DecodeNarrowOnCPUParallel(CPUKernel kernel, uint8_t* dst, const uint8_t* src, int width, int height, TexType type);
+
+// SSE picks the best kernel for the host
 template<bool SSE>
-void DecodeOnCPU(uint32_t* dst, uint8_t* src, int width, int height, TexType type);
+void DecodeOnCPU(uint32_t* dst, uint8_t* src, int width, int height, TexType type,
+                 const uint8_t* tlut = nullptr, TlutFormat tlut_fmt = TlutFormat::IA8);
+
+// Splits the texture into bands of block rows and decodes them on a persistent thread pool.
+// Falls back to a single DecodeOnCPU call when the texture is smaller than two bands.
+template<bool SSE>
+void DecodeOnCPUParallel(uint32_t* dst, uint8_t* src, int width, int height, TexType type,
+                         const uint8_t* tlut = nullptr, TlutFormat tlut_fmt = TlutFormat::IA8);
+
+// 0 picks std::thread::hardware_concurrency()
+void SetDecodeThreadCount(int threads);
+int GetDecodeThreadCount();
 
+// Smallest band, in texels, worth handing to another thread
+void SetDecodeMinBandTexels(int texels);
@@ -0,0 +1,65 @@
+#include <stdint.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+#include "CPUDetect.h"
+
+static void CPUID(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+#ifdef _MSC_VER
+	__cpuidex((int*)regs, leaf, subleaf);
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t XGetBV()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t eax, edx;
+	__asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+CPUInfo::CPUInfo()
+{
+	uint32_t regs[4];
+
+	CPUID(0, 0, regs);
+	const uint32_t max_leaf = regs[0];
+	if (max_leaf < 1)
+		return;
+
+	CPUID(1, 0, regs);
+	bSSE2 = (regs[3] >> 26) & 1;
+	bSSSE3 = (regs[2] >> 9) & 1;
+	bSSE4_1 = (regs[2] >> 19) & 1;
+
+	// The CPU supporting AVX isn't enough, the OS also has to save the registers
+	const bool osxsave = (regs[2] >> 27) & 1;
+	const uint64_t xcr0 = osxsave ? XGetBV() : 0;
+	const bool ymm_state = (xcr0 & 0x6) == 0x6;
+	const bool zmm_state = (xcr0 & 0xE6) == 0xE6;
+
+	bAVX = ((regs[2] >> 28) & 1) && ymm_state;
+
+	if (max_leaf < 7)
+		return;
+
+	CPUID(7, 0, regs);
+	bAVX2 = bAVX && ((regs[1] >> 5) & 1);
+
+	const bool avx512f = (regs[1] >> 16) & 1;
+	const bool avx512bw = (regs[1] >> 30) & 1;
+	const bool avx512vl = (regs[1] >> 31) & 1;
+	bAVX512 = bAVX2 && zmm_state && avx512f && avx512bw && avx512vl;
+}
+
+const CPUInfo cpu_info;
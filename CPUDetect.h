@@ -0,0 +1,18 @@
+#pragma once
+
+// Host SIMD support, filled in with cpuid/xgetbv so a single binary can
+// pick its decode kernels at runtime instead of at compile time.
+struct CPUInfo
+{
+	bool bSSE2 = false;
+	bool bSSSE3 = false;
+	bool bSSE4_1 = false;
+	bool bAVX = false;
+	bool bAVX2 = false;
+	// AVX-512 F + BW + VL, with the OS saving the zmm/opmask state
+	bool bAVX512 = false;
+
+	CPUInfo();
+};
+
+extern const CPUInfo cpu_info;
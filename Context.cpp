@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
 #include <waffle-1/waffle.h>
 #include <waffle-1/waffle_x11_egl.h>
 #include <waffle-1/waffle_glx.h>
@@ -11,6 +13,7 @@ namespace Context
 	waffle_display* dpy;
 	waffle_window* win;
 	waffle_context* ctx;
+	bool headless = false;
 
 	void SetWindowTitle()
 	{
@@ -32,29 +35,76 @@ namespace Context
 		}
 	}
 
-	void Create()
+	bool GetPlatformFromName(const char* name, Platform* platform)
 	{
+		static const struct { const char* name; Platform platform; } platforms[] = {
+			{ "auto", Platform::AUTO },
+			{ "glx", Platform::GLX },
+			{ "surfaceless", Platform::SURFACELESS },
+			{ "gbm", Platform::GBM },
+		};
+		for (const auto& p : platforms)
+			if (!strcasecmp(name, p.name))
+			{
+				*platform = p.platform;
+				return true;
+			}
+		return false;
+	}
+
+	bool Create(Platform platform)
+	{
+		if (platform == Platform::AUTO)
+			platform = getenv("DISPLAY") ? Platform::GLX : Platform::SURFACELESS;
+
+		int32_t waffle_platform = WAFFLE_PLATFORM_GLX;
+		switch(platform)
+		{
+		case Platform::SURFACELESS:
+			printf("Surfaceless EGL\n");
+			waffle_platform = WAFFLE_PLATFORM_SURFACELESS_EGL;
+		break;
+		case Platform::GBM:
+			printf("GBM\n");
+			waffle_platform = WAFFLE_PLATFORM_GBM;
+		break;
+		default:
+		break;
+		}
+		headless = platform != Platform::GLX;
+
 		int32_t init_attribs[] = {
-			WAFFLE_PLATFORM, WAFFLE_PLATFORM_GLX,
+			WAFFLE_PLATFORM, waffle_platform,
 			WAFFLE_NONE,
 		};
 
+		// Headless windows are pbuffers or GBM surfaces that are never shown
 		int32_t config_attribs[] = {
 			WAFFLE_CONTEXT_API, WAFFLE_CONTEXT_OPENGL_ES3,
+			WAFFLE_CONTEXT_MAJOR_VERSION, 3,
+			WAFFLE_CONTEXT_MINOR_VERSION, 2,
 			WAFFLE_RED_SIZE, 8,
 			WAFFLE_GREEN_SIZE, 8,
 			WAFFLE_BLUE_SIZE, 8,
 			WAFFLE_ALPHA_SIZE, 8,
-			WAFFLE_DOUBLE_BUFFERED, 1,
+			WAFFLE_DOUBLE_BUFFERED, headless ? 0 : 1,
 			WAFFLE_NONE,
 		};
 
 		// Init library
 		if (!waffle_init(init_attribs))
+		{
 			printf("Couldn't initialize waffle!\n");
+			return false;
+		}
 
 		// Open display
 		dpy = waffle_display_connect(nullptr);
+		if (!dpy)
+		{
+			printf("Couldn't open display!\n");
+			return false;
+		}
 
 		if (!waffle_display_supports_context_api(dpy, WAFFLE_CONTEXT_OPENGL_ES3))
 			printf("Display doesn't support ES 3!\n");
@@ -62,30 +112,43 @@ namespace Context
 		// Get the config we want
 		waffle_config* cfg = waffle_config_choose(dpy, config_attribs);
 		if (!cfg)
+		{
 			printf("Couldn't get waffle config!\n");
+			return false;
+		}
 
 		// Create our window
 		win = waffle_window_create(cfg, 256, 256);
 
-		SetWindowTitle();
-
 		if (!win)
+		{
 			printf("Couldn't create waffle window!\n");
+			waffle_config_destroy(cfg);
+			return false;
+		}
 
-		waffle_window_show(win);
+		if (!headless)
+		{
+			SetWindowTitle();
+			waffle_window_show(win);
+		}
 
 		// Create OpenGL context
 		ctx = waffle_context_create(cfg, nullptr);
 
+		waffle_config_destroy(cfg);
+
 		if (!ctx)
+		{
 			printf("Couldn't create waffle context!\n");
-
-		waffle_config_destroy(cfg);
+			return false;
+		}
 
 		// Make Current
 		waffle_make_current(dpy, win, ctx);
 
 		printf("Test: %p\n", waffle_get_proc_address("glGetString"));
+		return true;
 	}
 
 	void Shutdown()
@@ -98,6 +161,12 @@ namespace Context
 
 	void Swap()
 	{
-		waffle_window_swap_buffers(win);
+		if (!headless)
+			waffle_window_swap_buffers(win);
+	}
+
+	bool IsHeadless()
+	{
+		return headless;
 	}
 }
@@ -2,7 +2,23 @@
 
 namespace Context
 {
-	void Create();
+	enum class Platform
+	{
+		// GLX when there is an X display, surfaceless otherwise
+		AUTO,
+		GLX,
+		// No display, renders to a pbuffer. Works with llvmpipe on CPU-only machines.
+		SURFACELESS,
+		// Headless on a DRM render node
+		GBM,
+	};
+
+	bool GetPlatformFromName(const char* name, Platform* platform);
+
+	// GLES 3.2 context, returns false if the platform or context isn't available
+	bool Create(Platform platform = Platform::AUTO);
 	void Shutdown();
+	// No-op when headless, so nothing waits on vsync
 	void Swap();
+	bool IsHeadless();
 }
@@ -0,0 +1,212 @@
+#include <iterator>
+#include <stdio.h>
+
+#include "DecodeScheduler.h"
+
+// Weight left on the earlier time of a size by every new one
+static const double MODEL_KEEP = 0.99;
+// Samples are clipped to this many times the prediction, a preempted run shouldn't count in full
+static const double OUTLIER_LIMIT = 4;
+// Sizes kept per model, past that the one closest to another goes
+static const size_t MODEL_SIZES = 32;
+// Every this many decodes of a format and size go to the runner-up
+static const uint64_t EXPLORE_INTERVAL = 32;
+// The pick only changes for a backend this much cheaper, plus a us for the timer resolution
+static const double SWITCH_MARGIN = 1.25;
+static const int CALIBRATION_SIZES[] = { 32, 128, 512 };
+static const int CALIBRATION_RUNS = 3;
+
+void DecodeScheduler::Model::Add(int bytes, double us)
+{
+	const double predicted = Predict(bytes);
+	if (predicted > 0)
+		us = std::min(us, predicted * OUTLIER_LIMIT + 1);
+
+	auto size = sizes.find(bytes);
+	if (size != sizes.end())
+	{
+		size->second = size->second * MODEL_KEEP + us * (1 - MODEL_KEEP);
+		return;
+	}
+
+	size = sizes.emplace(bytes, us).first;
+	if (sizes.size() <= MODEL_SIZES)
+		return;
+
+	// Whichever neighbour is closer in size to the new one tells the least
+	auto prev = size == sizes.begin() ? sizes.end() : std::prev(size);
+	auto next = std::next(size);
+	if (next == sizes.end() || (prev != sizes.end() && (double)bytes / prev->first < (double)next->first / bytes))
+		sizes.erase(prev);
+	else
+		sizes.erase(next);
+}
+
+double DecodeScheduler::Model::Predict(int bytes) const
+{
+	if (sizes.empty())
+		return -1;
+
+	auto size = sizes.find(bytes);
+	if (size != sizes.end())
+		return size->second;
+
+	// Least squares line through the sizes we have
+	double n = 0, x = 0, y = 0, xx = 0, xy = 0;
+	for (const auto& sample : sizes)
+	{
+		n++;
+		x += sample.first;
+		y += sample.second;
+		xx += (double)sample.first * sample.first;
+		xy += sample.first * sample.second;
+	}
+
+	// With only one size the whole cost is per byte
+	double slope = xy / xx, fixed = 0;
+	if (n > 1)
+	{
+		slope = (n * xy - x * y) / (n * xx - x * x);
+		fixed = (y - slope * x) / n;
+	}
+	if (fixed < 0)
+	{
+		slope = xy / xx;
+		fixed = 0;
+	}
+	if (slope < 0)
+	{
+		slope = 0;
+		fixed = y / n;
+	}
+	return fixed + slope * bytes;
+}
+
+DecodeScheduler::DecodeScheduler(bool gpu)
+	: m_calibrated((size_t)TexType::TYPE_COUNT)
+{
+	for (int i = 0; i < (int)CPUKernel::COUNT; ++i)
+		if (IsCPUKernelSupported((CPUKernel)i))
+			m_backends.push_back({ GetCPUKernelName((CPUKernel)i), false, (CPUKernel)i, false });
+	if (GetDecodeThreadCount() > 1)
+		m_backends.push_back({ std::string(GetCPUKernelName(GetBestCPUKernel())) + "-mt", false, GetBestCPUKernel(), true });
+	if (gpu)
+	{
+		m_gpu = (int)m_backends.size();
+		m_backends.push_back({ "GPU", true, CPUKernel::SCALAR, false });
+	}
+}
+
+void DecodeScheduler::Calibrate(TexType type, const std::function<double(int backend, uint8_t* src, int width, int height)>& run)
+{
+	uint32_t seed = 1;
+	std::vector<uint8_t> src;
+	for (int size : CALIBRATION_SIZES)
+	{
+		src.resize(GetEncodedSize(type, size, size));
+		for (uint8_t& byte : src)
+		{
+			seed = seed * 1103515245 + 12345;
+			byte = seed >> 24;
+		}
+
+		for (int i = 0; i < (int)m_backends.size(); ++i)
+		{
+			// The first run pays for programs, textures and caches
+			double best = run(i, &src[0], size, size);
+			for (int j = 0; j < CALIBRATION_RUNS; ++j)
+				best = std::min(best, run(i, &src[0], size, size));
+			Observe(type, i, size, size, best);
+		}
+	}
+	m_calibrated[(size_t)type] = true;
+
+	printf("Scheduler calibrated %s:", GetTexInfo(type).name);
+	for (int i = 0; i < (int)m_backends.size(); ++i)
+		printf(" %s %.0f/%.0f/%.0fus", m_backends[i].name.c_str(),
+			Predict(type, i, CALIBRATION_SIZES[0], CALIBRATION_SIZES[0]),
+			Predict(type, i, CALIBRATION_SIZES[1], CALIBRATION_SIZES[1]),
+			Predict(type, i, CALIBRATION_SIZES[2], CALIBRATION_SIZES[2]));
+	printf(" at %d/%d/%d\n", CALIBRATION_SIZES[0], CALIBRATION_SIZES[1], CALIBRATION_SIZES[2]);
+}
+
+bool DecodeScheduler::IsCalibrated(TexType type) const
+{
+	return m_calibrated[(size_t)type];
+}
+
+int DecodeScheduler::Choose(TexType type, int width, int height)
+{
+	Decisions& decisions = m_decisions[std::make_tuple(type, width, height)];
+	decisions.runs.resize(m_backends.size());
+
+	// Backends with no samples yet get tried before anything else
+	int best = -1, second = -1;
+	double best_us = 0, second_us = 0;
+	for (int i = 0; i < (int)m_backends.size(); ++i)
+	{
+		const double us = Predict(type, i, width, height);
+		if (us < 0)
+		{
+			decisions.runs[i]++;
+			return i;
+		}
+		if (best < 0 || us < best_us)
+		{
+			second = best;
+			second_us = best_us;
+			best = i;
+			best_us = us;
+		}
+		else if (second < 0 || us < second_us)
+		{
+			second = i;
+			second_us = us;
+		}
+	}
+
+	decisions.count++;
+	if (second >= 0 && decisions.count % EXPLORE_INTERVAL == 0)
+	{
+		decisions.runs[second]++;
+		return second;
+	}
+
+	if (decisions.last >= 0 && Predict(type, decisions.last, width, height) <= best_us * SWITCH_MARGIN + 1)
+		best = decisions.last;
+	else if (best != decisions.last)
+	{
+		printf("Scheduler: %s %dx%d -> %s, predicted", GetTexInfo(type).name, width, height, m_backends[best].name.c_str());
+		for (int i = 0; i < (int)m_backends.size(); ++i)
+			printf(" %s %.0fus", m_backends[i].name.c_str(), Predict(type, i, width, height));
+		printf("\n");
+		decisions.last = best;
+	}
+	decisions.runs[best]++;
+	return best;
+}
+
+void DecodeScheduler::Observe(TexType type, int backend, int width, int height, double us)
+{
+	m_models[std::make_pair(type, backend)].Add(GetEncodedSize(type, width, height), us);
+}
+
+double DecodeScheduler::Predict(TexType type, int backend, int width, int height) const
+{
+	auto model = m_models.find(std::make_pair(type, backend));
+	if (model == m_models.end())
+		return -1;
+	return model->second.Predict(GetEncodedSize(type, width, height));
+}
+
+void DecodeScheduler::PrintStats(TexType type, int width, int height)
+{
+	Decisions& decisions = m_decisions[std::make_tuple(type, width, height)];
+	decisions.runs.resize(m_backends.size());
+
+	printf("Scheduler %s %dx%d:", GetTexInfo(type).name, width, height);
+	for (int i = 0; i < (int)m_backends.size(); ++i)
+		printf(" %s %ld runs (%.0fus)", m_backends[i].name.c_str(), decisions.runs[i], Predict(type, i, width, height));
+	printf("\n");
+	std::fill(decisions.runs.begin(), decisions.runs.end(), 0);
+}
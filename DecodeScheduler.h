@@ -0,0 +1,72 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <stdint.h>
+
+#include "CPUDecoder.h"
+#include "DecodeTypes.h"
+
+// Picks where each texture gets decoded, from a cost model per format and backend: the time
+// of every encoded size seen so far, smoothed over the decodes of it, and a fixed cost plus a cost
+// per encoded byte fitted through those for other sizes. Starts out with calibration runs.
+class DecodeScheduler
+{
+public:
+	struct Backend
+	{
+		std::string name;
+		bool gpu;
+		// CPU backends only
+		CPUKernel kernel;
+		bool threaded;
+	};
+
+	// Every kernel the host supports single threaded, the best one band-parallel, and the GPU
+	explicit DecodeScheduler(bool gpu);
+
+	const std::vector<Backend>& GetBackends() const { return m_backends; }
+	// -1 without one
+	int GetGPUBackend() const { return m_gpu; }
+
+	// run decodes src, width x height texels of type, on a backend and returns the us that took.
+	// Called for every backend over a few sizes of random data.
+	void Calibrate(TexType type, const std::function<double(int backend, uint8_t* src, int width, int height)>& run);
+	bool IsCalibrated(TexType type) const;
+
+	// The cheapest backend, or now and then the runner-up so its model keeps up with the device.
+	// Prints whenever the pick for a format and size changes.
+	int Choose(TexType type, int width, int height);
+	void Observe(TexType type, int backend, int width, int height, double us);
+	// us, negative before the first Observe
+	double Predict(TexType type, int backend, int width, int height) const;
+
+	// Decodes per backend since the last call, next to what the model predicts for them
+	void PrintStats(TexType type, int width, int height);
+
+private:
+	struct Model
+	{
+		// us by encoded bytes
+		std::map<int, double> sizes;
+
+		void Add(int bytes, double us);
+		double Predict(int bytes) const;
+	};
+
+	struct Decisions
+	{
+		int last = -1;
+		uint64_t count = 0;
+		std::vector<uint64_t> runs;
+	};
+
+	std::vector<Backend> m_backends;
+	int m_gpu = -1;
+	std::vector<bool> m_calibrated;
+	std::map<std::pair<TexType, int>, Model> m_models;
+	std::map<std::tuple<TexType, int, int>, Decisions> m_decisions;
+};
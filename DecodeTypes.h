@@ -1,7 +1,240 @@
 #pragma once
 
+#include <algorithm>
+#include <stdint.h>
+#include <strings.h>
+
 enum class TexType
 {
+	TYPE_I4,
+	TYPE_I8,
+	TYPE_IA4,
+	TYPE_IA8,
 	TYPE_RGB565,
+	TYPE_RGB5A3,
+	TYPE_RGBA8,
+	TYPE_CMPR,
+	TYPE_C4,
+	TYPE_C8,
+	TYPE_C14X2,
+	TYPE_COUNT,
+};
+
+// Palette (TLUT) entry formats, every entry is a big-endian 16-bit value
+enum class TlutFormat
+{
+	IA8,
+	RGB565,
+	RGB5A3,
+	COUNT,
+};
+
+// What textures decode to. The narrow ones hold what some formats have without loss: R8 intensity,
+// RG8 intensity and alpha, RGB565 the texels as they are, native endian.
+enum class DecodedFormat
+{
+	RGBA8,
+	R8,
+	RG8,
+	RGB565,
+	COUNT,
+};
+
+struct TexInfo
+{
+	const char* name;
+	// Texels per block
+	int block_w, block_h;
+	// Encoded bytes per block
+	int block_bytes;
 };
 
+inline TexInfo GetTexInfo(TexType type)
+{
+	switch(type)
+	{
+	case TexType::TYPE_I4:
+		return { "I4", 8, 8, 32 };
+	case TexType::TYPE_I8:
+		return { "I8", 8, 4, 32 };
+	case TexType::TYPE_IA4:
+		return { "IA4", 8, 4, 32 };
+	case TexType::TYPE_IA8:
+		return { "IA8", 4, 4, 32 };
+	case TexType::TYPE_RGB565:
+		return { "RGB565", 4, 4, 32 };
+	case TexType::TYPE_RGB5A3:
+		return { "RGB5A3", 4, 4, 32 };
+	case TexType::TYPE_RGBA8:
+		// 32 bytes of AR pairs followed by 32 bytes of GB pairs
+		return { "RGBA8", 4, 4, 64 };
+	case TexType::TYPE_CMPR:
+		// Four 4x4 DXT1-style sub-blocks of 8 bytes each
+		return { "CMPR", 8, 8, 32 };
+	// Paletted formats share the tiling of the intensity formats of the same width
+	case TexType::TYPE_C4:
+		return { "C4", 8, 8, 32 };
+	case TexType::TYPE_C8:
+		return { "C8", 8, 4, 32 };
+	case TexType::TYPE_C14X2:
+		// 14-bit indices in big-endian 16-bit texels
+		return { "C14X2", 4, 4, 32 };
+	default:
+		return { "?", 4, 4, 32 };
+	}
+}
+
+// Size of the tiled encoded texture, partial blocks are padded out
+inline int GetEncodedSize(TexType type, int width, int height)
+{
+	const TexInfo info = GetTexInfo(type);
+	return ((width + info.block_w - 1) / info.block_w) *
+	       ((height + info.block_h - 1) / info.block_h) * info.block_bytes;
+}
+
+// Levels from width x height down to 1x1
+inline int GetMipLevelCount(int width, int height)
+{
+	int levels = 1;
+	while ((width | height) >> levels)
+		levels++;
+	return levels;
+}
+
+// Each level is half the last, rounded down to at least 1
+inline int GetMipSize(int size, int level)
+{
+	return std::max(size >> level, 1);
+}
+
+// Mip chains are stored level after level, each padded out to whole tiles
+inline int GetMipChainEncodedSize(TexType type, int width, int height, int levels)
+{
+	int size = 0;
+	for (int level = 0; level < levels; ++level)
+		size += GetEncodedSize(type, GetMipSize(width, level), GetMipSize(height, level));
+	return size;
+}
+
+inline bool IsPaletted(TexType type)
+{
+	return type == TexType::TYPE_C4 || type == TexType::TYPE_C8 || type == TexType::TYPE_C14X2;
+}
+
+// TLUT entries a paletted format can index, 0 for everything else
+inline int GetPaletteSize(TexType type)
+{
+	switch(type)
+	{
+	case TexType::TYPE_C4:
+		return 16;
+	case TexType::TYPE_C8:
+		return 256;
+	case TexType::TYPE_C14X2:
+		return 1 << 14;
+	default:
+		return 0;
+	}
+}
+
+// The narrowest format type decodes to losslessly, RGBA8 for the ones that need all of it
+inline DecodedFormat GetNarrowFormat(TexType type)
+{
+	switch(type)
+	{
+	case TexType::TYPE_I4:
+	case TexType::TYPE_I8:
+		return DecodedFormat::R8;
+	case TexType::TYPE_IA4:
+	case TexType::TYPE_IA8:
+		return DecodedFormat::RG8;
+	case TexType::TYPE_RGB565:
+		return DecodedFormat::RGB565;
+	default:
+		return DecodedFormat::RGBA8;
+	}
+}
+
+inline int GetDecodedTexelBytes(DecodedFormat format)
+{
+	switch(format)
+	{
+	case DecodedFormat::R8: return 1;
+	case DecodedFormat::RG8:
+	case DecodedFormat::RGB565: return 2;
+	default: return 4;
+	}
+}
+
+// Decoded rows are padded to 4 bytes, GL's default unpack alignment
+inline int GetDecodedPitch(DecodedFormat format, int width)
+{
+	return (width * GetDecodedTexelBytes(format) + 3) & ~3;
+}
+
+inline const char* GetDecodedFormatName(DecodedFormat format)
+{
+	switch(format)
+	{
+	case DecodedFormat::RGBA8: return "RGBA8";
+	case DecodedFormat::R8: return "R8";
+	case DecodedFormat::RG8: return "RG8";
+	case DecodedFormat::RGB565: return "RGB565";
+	default: return "?";
+	}
+}
+
+inline const char* GetTlutFormatName(TlutFormat fmt)
+{
+	switch(fmt)
+	{
+	case TlutFormat::IA8: return "IA8";
+	case TlutFormat::RGB565: return "RGB565";
+	case TlutFormat::RGB5A3: return "RGB5A3";
+	default: return "?";
+	}
+}
+
+inline bool GetTexTypeFromName(const char* name, TexType* type)
+{
+	for (int i = 0; i < (int)TexType::TYPE_COUNT; ++i)
+		if (!strcasecmp(name, GetTexInfo((TexType)i).name))
+		{
+			*type = (TexType)i;
+			return true;
+		}
+	return false;
+}
+
+// Texture format numbers the GX hardware and dumps of it use
+inline bool GetTexTypeFromGX(uint32_t format, TexType* type)
+{
+	switch (format)
+	{
+	case 0x0: *type = TexType::TYPE_I4; return true;
+	case 0x1: *type = TexType::TYPE_I8; return true;
+	case 0x2: *type = TexType::TYPE_IA4; return true;
+	case 0x3: *type = TexType::TYPE_IA8; return true;
+	case 0x4: *type = TexType::TYPE_RGB565; return true;
+	case 0x5: *type = TexType::TYPE_RGB5A3; return true;
+	case 0x6: *type = TexType::TYPE_RGBA8; return true;
+	case 0x8: *type = TexType::TYPE_C4; return true;
+	case 0x9: *type = TexType::TYPE_C8; return true;
+	case 0xA: *type = TexType::TYPE_C14X2; return true;
+	case 0xE: *type = TexType::TYPE_CMPR; return true;
+	default: return false;
+	}
+}
+
+inline uint32_t GetGXFormat(TexType type)
+{
+	switch (type)
+	{
+	case TexType::TYPE_C4: return 0x8;
+	case TexType::TYPE_C8: return 0x9;
+	case TexType::TYPE_C14X2: return 0xA;
+	case TexType::TYPE_CMPR: return 0xE;
+	// I4 through RGBA8 are numbered in order
+	default: return (uint32_t)type;
+	}
+}
@@ -6,6 +6,13 @@
 
 namespace GLUtils
 {
+	static bool s_dump_shaders = false;
+
+	void SetDumpShaders(bool enable)
+	{
+		s_dump_shaders = enable;
+	}
+
 	bool CheckShaderStatus(GLuint shader, std::string type, const char* src)
 	{
 		GLint stat, compileStatus;
@@ -37,6 +44,9 @@ namespace GLUtils
 			return false;
 		}
 
+		if (!s_dump_shaders)
+			return true;
+
 		std::ofstream myfile;
 
 		std::string filename = "good_" + type;
@@ -65,4 +75,19 @@ namespace GLUtils
 		}
 		return true;
 	}
+	size_t GetTextureSize(GLenum format, int width, int height)
+	{
+		switch (format)
+		{
+		case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+			return (size_t)((width + 3) / 4) * ((height + 3) / 4) * 8;
+		case GL_R8:
+			return (size_t)width * height;
+		case GL_RG8:
+		case GL_RGB565:
+			return (size_t)width * height * 2;
+		default:
+			return (size_t)width * height * 4;
+		}
+	}
 }
@@ -5,7 +5,13 @@
 
 namespace GLUtils
 {
+	// Shaders that compile are only written to good_<type> when asked to,
+	// ones that don't always go to bad_<type>
+	void SetDumpShaders(bool enable);
 	bool CheckShaderStatus(GLuint shader, std::string type, const char* src);
 	bool CheckProgramLinkStatus(GLuint pgm);
 
+	// Bytes of one level of a texture in the internal formats decodes go to
+	size_t GetTextureSize(GLenum format, int width, int height);
+
 }
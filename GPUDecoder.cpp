@@ -1,11 +1,17 @@
+#include <algorithm>
+#include <array>
 #include <map>
 #include <sstream>
+#include <string.h>
+#include <tuple>
 
 #include "CPUDecoder.h"
 #include "GLUtils.h"
 #include "GPUDecoder.h"
+#include "Hash.h"
+#include "ProgramCache.h"
 
-std::string GenHeader(TexType type)
+std::string GenHeader(TexType type, OutputMode out_mode = OutputMode::IMAGE)
 {
 	std::ostringstream output;
 	output <<
@@ -14,6 +20,19 @@ std::string GenHeader(TexType type)
 	"precision highp uimage2D;\n"
 	"precision highp usamplerBuffer;\n"
 
+//	"layout(rgba16ui, binding = 0) readonly uniform uimageBuffer enc_tex;\n"
+	"layout(binding = 9) uniform usamplerBuffer enc_buf;\n"
+
+	"uint Convert3To8(uint val)\n"
+	"{\n"
+		"\treturn (val << 5) | (val << 2) | (val >> 1);\n"
+	"}\n\n"
+
+	"uint Convert4To8(uint val)\n"
+	"{\n"
+		"\treturn (val << 4) | val;\n"
+	"}\n\n"
+
 	"uint Convert5To8(uint val)\n"
 	"{\n"
 		"\treturn (val << 3) | (val >> 2);\n"
@@ -27,248 +46,2159 @@ std::string GenHeader(TexType type)
 	"uint bswap16(uint src)\n"
 	"{\n"
 	"	return ((src & 0xFFu) << 8u) | (src >> 8u);\n"
+	"}\n\n"
+
+	"uvec4 DecodeRGB5A3(uint val)\n"
+	"{\n"
+	"	uvec4 opaque = uvec4(Convert5To8((val >> 10u) & 0x1Fu), Convert5To8((val >> 5u) & 0x1Fu),\n"
+	"	                     Convert5To8(val & 0x1Fu), 0xFFu);\n"
+	"	uvec4 alpha = uvec4(Convert4To8((val >> 8u) & 0xFu), Convert4To8((val >> 4u) & 0xFu),\n"
+	"	                    Convert4To8(val & 0xFu), Convert3To8((val >> 12u) & 0x7u));\n"
+	"	return (val & 0x8000u) != 0u ? opaque : alpha;\n"
 	"}\n";
 
+	// Buffer output is packed RGBA8 rows, bounds checked since nothing else stops
+	// a partial tile from spilling into the next row
+	if (out_mode == OutputMode::BUFFER)
+		output <<
+		"layout(std430, binding = 1) writeonly buffer dec_buf { uint dec_texels[]; };\n"
+		"uniform ivec2 dec_size;\n"
+
+		"void StoreTexel(ivec2 coords, uvec4 col)\n"
+		"{\n"
+		"	if (any(greaterThanEqual(coords, dec_size)))\n"
+		"		return;\n"
+		"	dec_texels[coords.y * dec_size.x + coords.x] = col.r | (col.g << 8u) | (col.b << 16u) | (col.a << 24u);\n"
+		"}\n";
+	else
+		output <<
+		"layout(rgba8ui, binding = 1) writeonly uniform uimage2D dec_tex;\n"
+
+		"void StoreTexel(ivec2 coords, uvec4 col)\n"
+		"{\n"
+		"	imageStore(dec_tex, coords, col);\n"
+		"}\n";
+
+	// The TLUT is an r16ui buffer of big-endian entries, its format a TlutFormat
+	if (IsPaletted(type))
+		output <<
+		"layout(binding = 10) uniform usamplerBuffer tlut_buf;\n"
+		"uniform uint tlut_format;\n"
+
+		"uvec4 DecodeTLUT(uint index)\n"
+		"{\n"
+		"	uint val = bswap16(texelFetch(tlut_buf, int(index)).r);\n"
+		"	if (tlut_format == " << (int)TlutFormat::IA8 << "u)\n"
+		"		return uvec4(uvec3(val & 0xFFu), val >> 8u);\n"
+		"	if (tlut_format == " << (int)TlutFormat::RGB565 << "u)\n"
+		"		return uvec4(Convert5To8(val >> 11u), Convert6To8((val >> 5u) & 0x3Fu), Convert5To8(val & 0x1Fu), 0xFFu);\n"
+		"	return DecodeRGB5A3(val);\n"
+		"}\n";
+
 
 	return output.str();
 }
 
-std::map<TexType, GLuint> s_pgms;
+bool UsesDecoderVariant(TexType type)
+{
+	return type != TexType::TYPE_RGBA8 && type != TexType::TYPE_CMPR;
+}
 
-#define RGB565_DIVISOR 4
+DecoderVariant GetDefaultVariant(TexType type)
+{
+	const TexInfo info = GetTexInfo(type);
+	return { info.block_w, info.block_h, 1, 1 };
+}
 
-GLuint GenerateDecoderProgram(TexType type)
+static int GetBitsPerTexel(TexType type)
 {
-	auto it = s_pgms.find(type);
-	if (it != s_pgms.end())
-		return it->second;
+	const TexInfo info = GetTexInfo(type);
+	return info.block_bytes * 8 / (info.block_w * info.block_h);
+}
+
+// Words an invocation decodes from. Its bytes are aligned to their own size,
+// so they never straddle a fetch.
+static int GetVariantWords(TexType type, const DecoderVariant& variant)
+{
+	return std::max(variant.texels * GetBitsPerTexel(type) / 32, 1);
+}
+
+// DecodeTexel(tile_offset, texel) for every format, and DecodeIndex for the paletted ones.
+// texel counts across tile rows, whatever LoadByte is defined as reads the encoded bytes.
+std::string GenTexelFunctions(TexType type)
+{
+	std::string decoder;
+
+	if (IsPaletted(type))
+	{
+		decoder +=
+		"uint DecodeIndex(uint tile_offset, uint texel)\n"
+		"{\n";
+		switch(type)
+		{
+		case TexType::TYPE_C4:
+			decoder +=
+			"	uint val = LoadByte(tile_offset + (texel >> 1u));\n"
+			"	return (texel & 1u) == 0u ? (val >> 4u) : (val & 0xFu);\n";
+		break;
+		case TexType::TYPE_C8:
+			decoder +=
+			"	return LoadByte(tile_offset + texel);\n";
+		break;
+		default:
+			decoder +=
+			"	return ((LoadByte(tile_offset + texel * 2u) << 8u) | LoadByte(tile_offset + texel * 2u + 1u)) & 0x3FFFu;\n";
+		break;
+		}
+		decoder += "}\n\n";
+	}
+
+	decoder +=
+	"uvec4 DecodeTexel(uint tile_offset, uint texel)\n"
+	"{\n";
 
-	std::string cs_src;
-	cs_src += GenHeader(type);
 	switch(type)
 	{
+	case TexType::TYPE_I4:
+		decoder +=
+		"	uint val = LoadByte(tile_offset + (texel >> 1u));\n"
+		"	uint i = Convert4To8((texel & 1u) == 0u ? (val >> 4u) : (val & 0xFu));\n"
+		"	return uvec4(i);\n";
+	break;
+	case TexType::TYPE_I8:
+		decoder +=
+		"	return uvec4(LoadByte(tile_offset + texel));\n";
+	break;
+	case TexType::TYPE_IA4:
+		decoder +=
+		"	uint val = LoadByte(tile_offset + texel);\n"
+		"	uint i = Convert4To8(val & 0xFu);\n"
+		"	return uvec4(i, i, i, Convert4To8(val >> 4u));\n";
+	break;
+	case TexType::TYPE_IA8:
+		decoder +=
+		"	uint a = LoadByte(tile_offset + texel * 2u);\n"
+		"	uint i = LoadByte(tile_offset + texel * 2u + 1u);\n"
+		"	return uvec4(i, i, i, a);\n";
+	break;
 	case TexType::TYPE_RGB565:
+		decoder +=
+		"	uint val = (LoadByte(tile_offset + texel * 2u) << 8u) | LoadByte(tile_offset + texel * 2u + 1u);\n"
+		"	return uvec4(Convert5To8(val >> 11u), Convert6To8((val >> 5u) & 0x3Fu), Convert5To8(val & 0x1Fu), 0xFFu);\n";
+	break;
+	case TexType::TYPE_RGB5A3:
+		decoder +=
+		"	uint val = (LoadByte(tile_offset + texel * 2u) << 8u) | LoadByte(tile_offset + texel * 2u + 1u);\n"
+		"	return DecodeRGB5A3(val);\n";
+	break;
+	case TexType::TYPE_C4:
+	case TexType::TYPE_C8:
+	case TexType::TYPE_C14X2:
+		decoder +=
+		"	return DecodeTLUT(DecodeIndex(tile_offset, texel));\n";
+	break;
+	// The shaders for these two decode a tile together, this is for one texel at a time
+	case TexType::TYPE_RGBA8:
+		decoder +=
+		"	uint a = LoadByte(tile_offset + texel * 2u);\n"
+		"	uint r = LoadByte(tile_offset + texel * 2u + 1u);\n"
+		"	uint g = LoadByte(tile_offset + texel * 2u + 32u);\n"
+		"	uint b = LoadByte(tile_offset + texel * 2u + 33u);\n"
+		"	return uvec4(r, g, b, a);\n";
+	break;
+	case TexType::TYPE_CMPR:
+		decoder +=
+		"	uint x = texel % 8u, y = texel / 8u;\n"
+		"	uint block = tile_offset + ((y / 4u) * 2u + x / 4u) * 8u;\n"
+		"	uint c1 = (LoadByte(block) << 8u) | LoadByte(block + 1u);\n"
+		"	uint c2 = (LoadByte(block + 2u) << 8u) | LoadByte(block + 3u);\n"
+		"	uint sel = (LoadByte(block + 4u + y % 4u) >> (6u - (x % 4u) * 2u)) & 3u;\n"
+		"	uvec3 rgb1 = uvec3(Convert5To8(c1 >> 11u), Convert6To8((c1 >> 5u) & 0x3Fu), Convert5To8(c1 & 0x1Fu));\n"
+		"	uvec3 rgb2 = uvec3(Convert5To8(c2 >> 11u), Convert6To8((c2 >> 5u) & 0x3Fu), Convert5To8(c2 & 0x1Fu));\n"
+		"	if (sel < 2u)\n"
+		"		return uvec4(sel == 0u ? rgb1 : rgb2, 0xFFu);\n"
+		"	if (c1 > c2)\n"
+		"		return uvec4(sel == 2u ? (rgb2 * 3u + rgb1 * 5u) >> 3u : (rgb1 * 3u + rgb2 * 5u) >> 3u, 0xFFu);\n"
+		"	return uvec4((rgb1 + rgb2 + 1u) >> 1u, sel == 2u ? 0xFFu : 0u);\n";
+	break;
+	default:
+	break;
+	}
+	decoder += "}\n\n";
+
+	return decoder;
+}
+
+// Formats simple enough to decode each texel on its own.
+// Each invocation fetches the words holding variant.texels consecutive texels of a tile row,
+// then decodes them one by one out of enc_words.
+// With indices_only, paletted formats write their raw indices to an r32ui image instead.
+std::string GenTexelDecoder(TexType type, const DecoderVariant& variant, bool indices_only = false)
+{
+	const TexInfo info = GetTexInfo(type);
+	const int words = GetVariantWords(type, variant);
+	std::string decoder;
+
+	decoder +=
+	"uint enc_words[" + std::to_string(words) + "];\n"
+	"uint enc_base;\n"
+
+	"uint LoadByte(uint offset)\n"
+	"{\n"
+	"	uint word = enc_words[(offset >> 2u) - enc_base];\n"
+	"	return (word >> ((offset & 3u) * 8u)) & 0xFFu;\n"
+	"}\n\n";
+	decoder += GenTexelFunctions(type);
+
+	std::ostringstream cs_main;
+	cs_main <<
+	"layout(local_size_x = " << variant.local_x << ", local_size_y = " << variant.local_y << ") in;\n";
+	if (indices_only)
+		cs_main <<
+		"layout(r32ui, binding = 2) writeonly uniform uimage2D idx_tex;\n";
+	cs_main <<
+	// Size of the whole texture, and where in it this dispatch starts
+	"uniform uvec2 dims;\n"
+	"uniform uvec2 origin;\n"
+	"void main() {\n"
+	"	uvec2 pos = origin + gl_GlobalInvocationID.xy * uvec2(" << variant.texels << "u, 1u);\n"
+	"	if (any(greaterThanEqual(pos, dims)))\n"
+	"		return;\n"
+	"	uvec2 tile = pos / uvec2(" << info.block_w << "u, " << info.block_h << "u);\n"
+	"	uint tiles_per_row = (dims.x + " << info.block_w - 1 << "u) / " << info.block_w << "u;\n"
+	"	uint tile_offset = (tile.y * tiles_per_row + tile.x) * " << info.block_bytes << "u;\n"
+	"	uint texel = (pos.y % " << info.block_h << "u) * " << info.block_w << "u + pos.x % " << info.block_w << "u;\n"
+	"	enc_base = (tile_offset + texel * " << GetBitsPerTexel(type) << "u / 8u) >> 2u;\n";
+
+	// Fetches are load_words wide, picking just the words wanted out of each
+	const int fetches = (words + variant.load_words - 1) / variant.load_words;
+	for (int i = 0; i < fetches; ++i)
 	{
-		const char* cs_test =
-		"#define RGB565_DIVISOR %d\n"
-		"layout(local_size_x = 4, local_size_y = 4) in;\n"
-//		"layout(rgba16ui, binding = 0) readonly uniform uimageBuffer enc_tex;\n"
-		"layout(rgba8ui, binding = 1) writeonly uniform uimage2D dec_tex;\n"
-		"layout(binding = 9) uniform usamplerBuffer enc_buf;\n"
+		cs_main << "	uvec4 fetch" << i << " = texelFetch(enc_buf, int(enc_base / " << variant.load_words << "u) + " << i << ");\n";
+		for (int j = 0; j < std::min(words, variant.load_words); ++j)
+			cs_main << "	enc_words[" << i * variant.load_words + j << "] = fetch" << i
+			        << "[enc_base % " << variant.load_words << "u + " << j << "u];\n";
+	}
 
-		"uvec4 LoadTexel(ivec2 dim, ivec2 loc)\n"
-		"{\n"
-			// X and Y are provided in regular linear x/y coordinates
-			// Source coordinates are Width * y + x
-			// Workgroup size is width / 4
-			// So source is (imageDim * (y / 2)) + (x / 2)
-			// enc_tex has two pixels per u32 so we need to
-			// Each texture load loads a u32
-			// Src 0 = (0,0) & (0, 1)
-			// Src 1 = (0,2) & (0x3)
-			// SRCDIM | offset
-			// ---------------
-			// (0, 0) | 0 (r)
-			// (0, 1) | 0 (g)
-			// (0, 2) | 0 (b)
-			// (0, 3) | 0 (a)
-			// (1, 0) | (32*1 / 2)+0/2 = 16
-			// (1, 1) | 16
-			// (1, 2) | 17
-			"\tint srcloc = ((dim.x * loc.y) >> 2) + (loc.x >> 2);\n"
-			//"\tuvec4 col0 = imageLoad(enc_tex, srcloc);\n"
-			"\tuvec4 col0 = texelFetch(enc_buf, srcloc);\n"
-			"\tcol0[0] = bswap16(col0[0]);\n"
-			"\tcol0[1] = bswap16(col0[1]);\n"
-			"\tcol0[2] = bswap16(col0[2]);\n"
-			"\tcol0[3] = bswap16(col0[3]);\n"
-			"\treturn col0;\n"
-		"}\n\n"
-
-		"// RGB565\n"
-		"void main() {\n"
-		"	ivec2 start = ivec2(gl_WorkGroupID.xy)* RGB565_DIVISOR;\n"
-		"	ivec2 dims = ivec2(gl_NumWorkGroups.xy)* RGB565_DIVISOR;\n"
-		"	uvec4 in_col[4];\n"
-#if 1
-		"	in_col[0] = LoadTexel(dims, start + ivec2(0, 0));\n"
-		"	in_col[1] = LoadTexel(dims, start + ivec2(0, 1));\n"
-		"	in_col[2] = LoadTexel(dims, start + ivec2(0, 2));\n"
-		"	in_col[3] = LoadTexel(dims, start + ivec2(0, 3));\n"
-#else
-		"	in_col[1] = in_col[2] = in_col[3] = in_col[0] = uvec4(0);\n"
-#endif
-		"	for (int y = 0; y < 4; ++y)\n"
-		"	{\n"
-		"		for (int x = 0; x < 4; ++x)\n"
-		"		{\n"
-		"			uvec4 out_col;\n"
-		"			out_col.r = Convert5To8((in_col[y][x] >> 11u) & 0x1Fu);\n"
-		"			out_col.g = Convert6To8((in_col[y][x] >>  5u) & 0x3Fu);\n"
-		"			out_col.b = Convert5To8(in_col[y][x]          & 0x1Fu);\n"
-		"			out_col.a = 0xFFu;\n"
-		"			imageStore(dec_tex, start + ivec2(x, y), out_col);\n"
-		"		}\n"
-		"	}\n"
-		"}\n";
+	cs_main <<
+	"	for (uint i = 0u; i < " << variant.texels << "u; ++i)\n";
+	if (indices_only)
+		cs_main <<
+		"		imageStore(idx_tex, ivec2(pos) + ivec2(i, 0), uvec4(DecodeIndex(tile_offset, texel + i)));\n";
+	else
+		cs_main <<
+		"		StoreTexel(ivec2(pos) + ivec2(i, 0), DecodeTexel(tile_offset, texel + i));\n";
+	cs_main <<
+	"}\n";
 
-		//for (int y = 0; y < height; y += 4)
-		//	for (int x = 0; x < width; x += 4)
-		//		for (int iy = 0; iy < 4; iy++, src += 8)
-		//		{
-		//			uint32_t *ptr = dst + (y + iy) * width + x;
-		//			uint16_t *s = (uint16_t *)src;
-		//			for (int j = 0; j < 4; j++)
-		//				*ptr++ = DecodePixel_RGB565(swap16(*s++));
-		//		}
+	return decoder + cs_main.str();
+}
 
-		char tmp[2048];
-		sprintf(tmp, cs_test, RGB565_DIVISOR);
-		cs_src += tmp;
-		GLuint cs = glCreateShader(GL_COMPUTE_SHADER);
-		GLuint cs_pgm = glCreateProgram();
+// RGBA8 tiles are 32 bytes of AR followed by 32 bytes of GB.
+// The first four invocations pull in the whole 64 byte tile before anyone decodes.
+const char* s_rgba8_decoder =
+	"layout(local_size_x = 4, local_size_y = 4) in;\n"
+	"uniform uvec2 dims;\n"
+	"uniform uvec2 origin;\n"
+	"shared uvec4 tile_data[4];\n"
 
-		std::array<const char*, 1> srcs = {
-			cs_src.c_str(),
-		};
-		glShaderSource(cs, 1, &srcs[0], NULL);
+	"uint LoadTileWord(uint word)\n"
+	"{\n"
+	"	return tile_data[word >> 2u][word & 3u];\n"
+	"}\n\n"
 
-		glCompileShader(cs);
+	"// RGBA8\n"
+	"void main() {\n"
+	"	uvec2 tile_pos = origin / 4u + gl_WorkGroupID.xy;\n"
+	"	uint tile = tile_pos.y * ((dims.x + 3u) / 4u) + tile_pos.x;\n"
+	"	uint texel = gl_LocalInvocationIndex;\n"
+	"	if (texel < 4u)\n"
+	"		tile_data[texel] = texelFetch(enc_buf, int(tile * 4u + texel));\n"
+	"	barrier();\n"
+	"	uint shift = (texel & 1u) * 16u;\n"
+	"	uint ar = LoadTileWord(texel >> 1u) >> shift;\n"
+	"	uint gb = LoadTileWord(8u + (texel >> 1u)) >> shift;\n"
+	"	uvec4 out_col = uvec4((ar >> 8u) & 0xFFu, gb & 0xFFu, (gb >> 8u) & 0xFFu, ar & 0xFFu);\n"
+	"	StoreTexel(ivec2(origin + gl_GlobalInvocationID.xy), out_col);\n"
+	"}\n";
 
-		GLUtils::CheckShaderStatus(cs, "cs", cs_src.c_str());
+// CMPR tiles are four DXT1-style sub-blocks, one invocation decodes a whole sub-block
+const char* s_cmpr_decoder =
+	"layout(local_size_x = 2, local_size_y = 2) in;\n"
+	"uniform uvec2 dims;\n"
+	"uniform uvec2 origin;\n"
 
-		glAttachShader(cs_pgm, cs);
-		glLinkProgram(cs_pgm);
+	"uvec3 DecodeRGB565(uint val)\n"
+	"{\n"
+	"	return uvec3(Convert5To8(val >> 11u), Convert6To8((val >> 5u) & 0x3Fu), Convert5To8(val & 0x1Fu));\n"
+	"}\n\n"
 
-		GLUtils::CheckProgramLinkStatus(cs_pgm);
-		s_pgms[type] = cs_pgm;
-		return cs_pgm;
-	}
+	"// CMPR\n"
+	"void main() {\n"
+	"	uvec2 tile_pos = origin / 8u + gl_WorkGroupID.xy;\n"
+	"	uint tile = tile_pos.y * ((dims.x + 7u) / 8u) + tile_pos.x;\n"
+	"	uvec2 block = texelFetch(enc_buf, int(tile * 4u + gl_LocalInvocationIndex)).xy;\n"
+	"	ivec2 corner = ivec2(origin + gl_GlobalInvocationID.xy * 4u);\n"
+	"	uint c1 = bswap16(block.x & 0xFFFFu);\n"
+	"	uint c2 = bswap16(block.x >> 16u);\n"
+	"	uvec3 rgb1 = DecodeRGB565(c1);\n"
+	"	uvec3 rgb2 = DecodeRGB565(c2);\n"
+	"	uvec4 colors[4];\n"
+	"	colors[0] = uvec4(rgb1, 0xFFu);\n"
+	"	colors[1] = uvec4(rgb2, 0xFFu);\n"
+	"	if (c1 > c2)\n"
+	"	{\n"
+	"		colors[2] = uvec4((rgb2 * 3u + rgb1 * 5u) >> 3u, 0xFFu);\n"
+	"		colors[3] = uvec4((rgb1 * 3u + rgb2 * 5u) >> 3u, 0xFFu);\n"
+	"	}\n"
+	"	else\n"
+	"	{\n"
+	"		uvec3 average = (rgb1 + rgb2 + 1u) >> 1u;\n"
+	"		colors[2] = uvec4(average, 0xFFu);\n"
+	"		colors[3] = uvec4(average, 0u);\n"
+	"	}\n"
+	"	for (int y = 0; y < 4; ++y)\n"
+	"	{\n"
+	"		uint row = block.y >> (uint(y) * 8u);\n"
+	"		for (int x = 0; x < 4; ++x)\n"
+	"			StoreTexel(corner + ivec2(x, y), colors[(row >> (6u - uint(x) * 2u)) & 3u]);\n"
+	"	}\n"
+	"}\n";
 
-	break;
+typedef std::tuple<TexType, int, int, int, int, OutputMode, bool> ProgramKey;
+std::map<ProgramKey, GLuint> s_pgms;
+
+std::string GenDecoderSource(TexType type, const DecoderVariant& variant, OutputMode output, bool indices_only)
+{
+	std::string cs_src;
+	cs_src += GenHeader(type, output);
+	if (UsesDecoderVariant(type))
+		cs_src += GenTexelDecoder(type, variant, indices_only);
+	else if (type == TexType::TYPE_RGBA8)
+		cs_src += s_rgba8_decoder;
+	else
+		cs_src += s_cmpr_decoder;
+	return cs_src;
+}
+
+// The RGBA8 and CMPR decoders have a fixed shape and ignore variant.
+// Index programs write idx_tex whatever the output mode.
+GLuint GenerateDecoderProgram(TexType type, const DecoderVariant& variant, OutputMode output, bool indices_only = false)
+{
+	const bool uses_variant = UsesDecoderVariant(type);
+	const DecoderVariant v = uses_variant ? variant : DecoderVariant{};
+	if (indices_only)
+		output = OutputMode::IMAGE;
+	const ProgramKey key(type, v.local_x, v.local_y, v.texels, v.load_words, output, indices_only);
+	auto it = s_pgms.find(key);
+	if (it != s_pgms.end())
+		return it->second;
+
+	GLuint cs_pgm = ProgramCache::CreateComputeProgram(GenDecoderSource(type, variant, output, indices_only));
+	s_pgms[key] = cs_pgm;
+	return cs_pgm;
+}
+
+// Builds every program not built yet in one go, rather than one at a time as they're first used
+void GenerateDecoderPrograms(TexType type, const std::vector<DecoderVariant>& variants, OutputMode output)
+{
+	std::vector<ProgramKey> keys;
+	std::vector<std::string> srcs;
+	for (const DecoderVariant& v : variants)
+	{
+		const ProgramKey key(type, v.local_x, v.local_y, v.texels, v.load_words, output, false);
+		if (s_pgms.count(key) || std::find(keys.begin(), keys.end(), key) != keys.end())
+			continue;
+		keys.push_back(key);
+		srcs.push_back(GenDecoderSource(type, v, output, false));
 	}
+
+	const std::vector<GLuint> pgms = ProgramCache::CreateComputePrograms(srcs);
+	for (size_t i = 0; i < keys.size(); ++i)
+		s_pgms[keys[i]] = pgms[i];
+}
+
+// CMPR to BC1, one invocation per sub-block writing one 8 byte BC1 block
+const char* s_bc1_transcoder =
+	"layout(local_size_x = 2, local_size_y = 2) in;\n"
+	"layout(std430, binding = 0) writeonly buffer bc1_buf { uvec2 bc1_blocks[]; };\n"
+	"uniform uvec2 dims;\n"
+	"uniform uvec2 origin;\n"
+
+	"void main() {\n"
+	"	uvec2 tile_pos = origin / 8u + gl_WorkGroupID.xy;\n"
+	"	uint tile = tile_pos.y * ((dims.x + 7u) / 8u) + tile_pos.x;\n"
+	"	uvec2 block = texelFetch(enc_buf, int(tile * 4u + gl_LocalInvocationIndex)).xy;\n"
+	"	// Endpoints to little-endian\n"
+	"	block.x = ((block.x & 0x00FF00FFu) << 8u) | ((block.x >> 8u) & 0x00FF00FFu);\n"
+	"	// First texel in the low bits of each row\n"
+	"	block.y = ((block.y & 0x33333333u) << 2u) | ((block.y >> 2u) & 0x33333333u);\n"
+	"	block.y = ((block.y & 0x0F0F0F0Fu) << 4u) | ((block.y >> 4u) & 0x0F0F0F0Fu);\n"
+	"	uvec2 blocks = (dims + 3u) / 4u;\n"
+	"	uvec2 block_pos = origin / 4u + gl_GlobalInvocationID.xy;\n"
+	"	if (any(greaterThanEqual(block_pos, blocks)))\n"
+	"		return;\n"
+	"	bc1_blocks[block_pos.y * blocks.x + block_pos.x] = block;\n"
+	"}\n";
+
+GLuint GenerateBC1TranscodeProgram()
+{
+	static GLuint s_bc1_pgm = 0;
+	if (!s_bc1_pgm)
+		s_bc1_pgm = ProgramCache::CreateComputeProgram(GenHeader(TexType::TYPE_CMPR) + s_bc1_transcoder);
+	return s_bc1_pgm;
+}
+
+// Second pass of the deferred TLUT path, one invocation per texel
+const char* s_tlut_apply =
+	"layout(local_size_x = 8, local_size_y = 8) in;\n"
+	"layout(r32ui, binding = 2) readonly uniform uimage2D idx_tex;\n"
+	"uniform uvec2 origin;\n"
+
+	"void main() {\n"
+	"	ivec2 coords = ivec2(origin + gl_GlobalInvocationID.xy);\n"
+	"	if (any(greaterThanEqual(coords, imageSize(idx_tex))))\n"
+	"		return;\n"
+	"	StoreTexel(coords, DecodeTLUT(imageLoad(idx_tex, coords).r));\n"
+	"}\n";
+
+GLuint GenerateTLUTApplyProgram(OutputMode output)
+{
+	static std::map<OutputMode, GLuint> s_apply_pgms;
+	GLuint& pgm = s_apply_pgms[output];
+	if (!pgm)
+		pgm = ProgramCache::CreateComputeProgram(GenHeader(TexType::TYPE_C8, output) + s_tlut_apply);
+	return pgm;
+}
+
+bool SupportsBC1()
+{
+	return epoxy_has_gl_extension("GL_EXT_texture_compression_s3tc") ||
+	       epoxy_has_gl_extension("GL_EXT_texture_compression_dxt1");
 }
 
 void DispatchType(TexType type, int w, int h)
+{
+	// One workgroup per block
+	const TexInfo info = GetTexInfo(type);
+	glDispatchCompute((w + info.block_w - 1) / info.block_w, (h + info.block_h - 1) / info.block_h, 1);
+}
+
+void DispatchVariant(const DecoderVariant& variant, int w, int h)
+{
+	const int group_w = variant.local_x * variant.texels;
+	glDispatchCompute((w + group_w - 1) / group_w, (h + variant.local_y - 1) / variant.local_y, 1);
+}
+
+// Texel format the encoded data is fetched with, through the enc_buf usamplerBuffer only.
+// GL_RG32UI is no image format in core GLES, so this never goes to glBindImageTexture.
+GLenum GetEncodedBufferFormat(TexType type, const DecoderVariant& variant)
 {
 	switch(type)
 	{
-	case TexType::TYPE_RGB565:
-		glDispatchCompute(w / RGB565_DIVISOR, h / RGB565_DIVISOR, 1);
-	break;
+	case TexType::TYPE_RGBA8:
+		// A quarter tile per texel fetch
+		return GL_RGBA32UI;
+	case TexType::TYPE_CMPR:
+		// One sub-block per texel fetch
+		return GL_RG32UI;
+	default:
+		// Everything else is fetched load_words words at a time
+		return variant.load_words == 4 ? GL_RGBA32UI : variant.load_words == 2 ? GL_RG32UI : GL_R32UI;
+	}
+}
+
+// Level sizes are packed into 16 bits each in the tile table
+static const int MAX_MIP_LEVELS = 16;
+
+// Decodes a list of textures in one dispatch, one workgroup per tile of all of them together.
+// Each workgroup looks its texture up in tile_table, so small textures cost their tiles and
+// nothing more. Mip chains go packed level after level into dec_texels, batches to the layers
+// of an array image.
+std::string GenTileTableDecoder(TexType type, const DecoderVariant& variant, bool to_array)
+{
+	const TexInfo info = GetTexInfo(type);
+	const GLenum format = GetEncodedBufferFormat(type, variant);
+	const int fetch_words = format == GL_RGBA32UI ? 4 : format == GL_RG32UI ? 2 : 1;
+
+	std::ostringstream output;
+	output <<
+	"uint LoadByte(uint offset)\n"
+	"{\n"
+	"	uint word = offset >> 2u;\n"
+	"	uint val = texelFetch(enc_buf, int(word / " << fetch_words << "u))[word % " << fetch_words << "u];\n"
+	"	return (val >> ((offset & 3u) * 8u)) & 0xFFu;\n"
+	"}\n\n"
+	<< GenTexelFunctions(type) <<
+	"layout(local_size_x = " << info.block_w << ", local_size_y = " << info.block_h << ") in;\n"
+	// First tile, encoded byte offset, output texel offset or layer, and width | height << 16
+	"layout(std430, binding = 2) readonly buffer tile_table { uvec4 entries[]; };\n"
+	"uniform uint num_entries;\n"
+	"uniform uint num_tiles;\n";
+	if (to_array)
+		output <<
+		"precision highp uimage2DArray;\n"
+		"layout(rgba8ui, binding = 1) writeonly uniform uimage2DArray dec_array;\n";
+	output <<
+	"shared uvec4 entry;\n"
+	"void main() {\n"
+	"	uint tile = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;\n"
+	// The whole workgroup is one tile, so one invocation searches for all of them
+	"	if (gl_LocalInvocationIndex == 0u && tile < num_tiles)\n"
+	"	{\n"
+	"		uint lo = 0u, hi = num_entries - 1u;\n"
+	"		while (lo < hi)\n"
+	"		{\n"
+	"			uint mid = (lo + hi + 1u) / 2u;\n"
+	"			if (tile >= entries[mid].x)\n"
+	"				lo = mid;\n"
+	"			else\n"
+	"				hi = mid - 1u;\n"
+	"		}\n"
+	"		entry = entries[lo];\n"
+	"	}\n"
+	"	barrier();\n"
+	"	if (tile >= num_tiles)\n"
+	"		return;\n"
+	"	uvec4 info = entry;\n"
+	"	uvec2 size = uvec2(info.w & 0xFFFFu, info.w >> 16u);\n"
+	"	uint tiles_per_row = (size.x + " << info.block_w - 1 << "u) / " << info.block_w << "u;\n"
+	"	tile -= info.x;\n"
+	"	uvec2 pos = uvec2(tile % tiles_per_row, tile / tiles_per_row) * gl_WorkGroupSize.xy + gl_LocalInvocationID.xy;\n"
+	// Textures narrower than a tile are still a whole one in the encoded data
+	"	if (any(greaterThanEqual(pos, size)))\n"
+	"		return;\n"
+	"	uvec4 col = DecodeTexel(info.y + tile * " << info.block_bytes << "u, gl_LocalInvocationIndex);\n";
+	if (to_array)
+		output <<
+		"	imageStore(dec_array, ivec3(pos, info.z), col);\n";
+	else
+		output <<
+		"	dec_texels[info.z + pos.y * size.x + pos.x] = col.r | (col.g << 8u) | (col.b << 16u) | (col.a << 24u);\n";
+	output <<
+	"}\n";
+	return output.str();
+}
+
+static size_t GetMipChainTexels(int w, int h, int levels)
+{
+	size_t texels = 0;
+	for (int level = 0; level < levels; ++level)
+		texels += (size_t)GetMipSize(w, level) * GetMipSize(h, level);
+	return texels;
+}
+
+GLuint GenerateTileTableProgram(TexType type, const DecoderVariant& variant, bool to_array)
+{
+	static std::map<std::tuple<TexType, GLenum, bool>, GLuint> s_table_pgms;
+	GLuint& pgm = s_table_pgms[std::make_tuple(type, GetEncodedBufferFormat(type, variant), to_array)];
+	if (!pgm)
+		pgm = ProgramCache::CreateComputeProgram(GenHeader(type, OutputMode::BUFFER) + GenTileTableDecoder(type, variant, to_array));
+	return pgm;
+}
+
+// Narrow output: one invocation per word of dec_texels, the 4 R8 or 2 RG8 or RGB565 texels of a tile row
+// that go in it, in rows of GetDecodedPitch bytes. Tile rows are 4 or 8 texels, so no word straddles two.
+std::string GenNarrowDecoder(TexType type, GLenum enc_format)
+{
+	const DecodedFormat format = GetNarrowFormat(type);
+	const TexInfo info = GetTexInfo(type);
+	const int fetch_words = enc_format == GL_RGBA32UI ? 4 : enc_format == GL_RG32UI ? 2 : 1;
+	const int texel_bits = GetDecodedTexelBytes(format) * 8;
+
+	std::ostringstream output;
+	output <<
+	"uint LoadByte(uint offset)\n"
+	"{\n"
+	"	uint word = offset >> 2u;\n"
+	"	uint val = texelFetch(enc_buf, int(word / " << fetch_words << "u))[word % " << fetch_words << "u];\n"
+	"	return (val >> ((offset & 3u) * 8u)) & 0xFFu;\n"
+	"}\n\n"
+	<< GenTexelFunctions(type) <<
+	"uint PackTexel(uint tile_offset, uint texel)\n"
+	"{\n";
+	if (format == DecodedFormat::RGB565)
+		// Only the byte swap
+		output <<
+		"	return (LoadByte(tile_offset + texel * 2u) << 8u) | LoadByte(tile_offset + texel * 2u + 1u);\n";
+	else if (format == DecodedFormat::RG8)
+		output <<
+		"	uvec4 col = DecodeTexel(tile_offset, texel);\n"
+		"	return col.r | (col.a << 8u);\n";
+	else
+		output <<
+		"	return DecodeTexel(tile_offset, texel).r;\n";
+	output <<
+	"}\n\n"
+
+	"layout(local_size_x = 8, local_size_y = 8) in;\n"
+	"uniform uvec2 dims;\n"
+	"uniform uvec2 origin;\n"
+	"uniform uint row_words;\n"
+	"void main() {\n"
+	"	uvec2 pos = origin + gl_GlobalInvocationID.xy * uvec2(" << 32 / texel_bits << "u, 1u);\n"
+	"	if (any(greaterThanEqual(pos, dims)))\n"
+	"		return;\n"
+	"	uvec2 tile = pos / uvec2(" << info.block_w << "u, " << info.block_h << "u);\n"
+	"	uint tiles_per_row = (dims.x + " << info.block_w - 1 << "u) / " << info.block_w << "u;\n"
+	"	uint tile_offset = (tile.y * tiles_per_row + tile.x) * " << info.block_bytes << "u;\n"
+	"	uint texel = (pos.y % " << info.block_h << "u) * " << info.block_w << "u + pos.x % " << info.block_w << "u;\n"
+	"	uint word = 0u;\n"
+	"	for (uint i = 0u; i < " << 32 / texel_bits << "u; ++i)\n"
+	"		word |= PackTexel(tile_offset, texel + i) << (i * " << texel_bits << "u);\n"
+	"	dec_texels[pos.y * row_words + pos.x / " << 32 / texel_bits << "u] = word;\n"
+	"}\n";
+	return output.str();
+}
+
+GLuint GenerateNarrowProgram(TexType type, GLenum enc_format)
+{
+	static std::map<std::pair<TexType, GLenum>, GLuint> s_narrow_pgms;
+	GLuint& pgm = s_narrow_pgms[std::make_pair(type, enc_format)];
+	if (!pgm)
+		pgm = ProgramCache::CreateComputeProgram(GenHeader(type, OutputMode::BUFFER) + GenNarrowDecoder(type, enc_format));
+	return pgm;
+}
+
+// How decoded texels go into GL. RGBA8 is read as an integer image, the narrow ones are sampled
+// and swizzled back to what RGBA8 would hold.
+struct GLTexFormat
+{
+	GLenum internal_format, format, type;
+};
+
+static GLTexFormat GetGLTexFormat(DecodedFormat format)
+{
+	switch(format)
+	{
+	case DecodedFormat::R8: return { GL_R8, GL_RED, GL_UNSIGNED_BYTE };
+	case DecodedFormat::RG8: return { GL_RG8, GL_RG, GL_UNSIGNED_BYTE };
+	case DecodedFormat::RGB565: return { GL_RGB565, GL_RGB, GL_UNSIGNED_SHORT_5_6_5 };
+	default: return { GL_RGBA8UI, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE };
 	}
 }
 
+// With the texture bound. Intensity goes to every colour channel, and to alpha as well without one.
+static void SetDecodedSwizzle(DecodedFormat format)
+{
+	if (format != DecodedFormat::R8 && format != DecodedFormat::RG8)
+		return;
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, GL_RED);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_A, format == DecodedFormat::R8 ? GL_RED : GL_GREEN);
+}
+
+// Adds a width x height texture to a tile table, whose tiles start at *tiles
+static void AddTileTableEntry(std::vector<GLuint>* table, GLuint* tiles, TexType type,
+                              GLuint enc_offset, GLuint output, int width, int height)
+{
+	const TexInfo info = GetTexInfo(type);
+	table->insert(table->end(), { *tiles, enc_offset, output, (GLuint)(width | (height << 16)) });
+	*tiles += ((width + info.block_w - 1) / info.block_w) * ((height + info.block_h - 1) / info.block_h);
+}
+
+// With pgm in use, the encoded data and output bound
+static void DispatchTileTable(GLuint pgm, GLuint table_buf, const std::vector<GLuint>& table, GLuint tiles)
+{
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, table_buf);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, table.size() * sizeof(GLuint), &table[0], GL_STREAM_DRAW);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, table_buf);
+	glUniform1ui(glGetUniformLocation(pgm, "num_entries"), table.size() / 4);
+	glUniform1ui(glGetUniformLocation(pgm, "num_tiles"), tiles);
+
+	// Wrapped into rows when there are more tiles than one dimension can dispatch
+	const GLuint groups_x = std::min<GLuint>(tiles, 65535);
+	glDispatchCompute(groups_x, (tiles + groups_x - 1) / groups_x, 1);
+}
+
+// Tuned variants are kept per format and rough texel count
+static int GetSizeClass(int w, int h)
+{
+	const int64_t texels = (int64_t)w * h;
+	if (texels <= 128 * 128)
+		return 0;
+	if (texels <= 512 * 512)
+		return 1;
+	if (texels <= 2048 * 2048)
+		return 2;
+	return 3;
+}
+
+std::map<std::pair<TexType, int>, DecoderVariant> s_tuned_variants;
+bool s_autotune = false;
+
+OutputMode s_output_mode = OutputMode::AUTO;
+// What AUTO measured on this device, AUTO until then
+OutputMode s_device_output = OutputMode::AUTO;
+static TexturePool* s_pool = nullptr;
+// Deletes whatever is released right away, for when nothing set a pool
+static TexturePool s_unpooled(0);
+
+void TextureConvert::SetAutotune(bool enable)
+{
+	s_autotune = enable;
+}
+
 TextureConvert::TextureConvert(TexType type, int w, int h)
 	: m_type(type), m_w(w), m_h(h)
 {
-	GLuint imgs[2];
+	auto tuned = s_tuned_variants.find(std::make_pair(m_type, GetSizeClass(m_w, m_h)));
+	m_variant = tuned != s_tuned_variants.end() ? tuned->second : GetDefaultVariant(m_type);
 
-	glGenTextures(2, imgs);
-	glGenBuffers(1, &enc_buf);
-	enc_img = imgs[0];
-	dec_img = imgs[1];
+	m_pool = s_pool ? s_pool : &s_unpooled;
 
 	printf("Creating texture\n");
 	// Encoded image
+	data.resize(GetEncodedSize(m_type, m_w, m_h));
+	cpudata.resize(m_w * m_h * 4);
+	enc_img = m_pool->GetBufferTexture();
+	enc_buf = m_pool->GetBuffer(data.size(), GL_STREAM_DRAW);
 	glBindTexture(GL_TEXTURE_BUFFER, enc_img);
 	glBindBuffer(GL_TEXTURE_BUFFER, enc_buf);
+	// Without buffer storage every upload reallocates enc_buf instead
+	if (StreamBuffer::IsSupported())
+		m_stream = m_pool->GetStreamBuffer(GL_TEXTURE_BUFFER, data.size());
+	GenData();
+	UploadData();
+	if (!m_stream)
+		BindEncodedBuffer();
 
-	// 8 bits per component
-	// 4 components per colour
-	// But since we are doing RGB565 it will be 16bits per colour
-	// So there will be two colours per texel fetch
-	data.resize(m_w * m_h * 2);
-	cpudata.resize(m_w * m_h * 4);
-	GenRGB565();
-	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA16UI, enc_buf);
-
-	// Decoded image
-	glBindTexture(GL_TEXTURE_2D, dec_img);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	// 8 bits per component
-	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8UI, m_w, m_h);
+	// Decoded image, 8 bits per component
+	dec_img = m_pool->GetTexture(GL_RGBA8UI, m_w, m_h, 1);
+	m_target = dec_img;
+
+	if (IsPaletted(m_type))
+	{
+		tlutdata.resize(GetPaletteSize(m_type) * 2);
+		tlut_img = m_pool->GetBufferTexture();
+		tlut_buf = m_pool->GetBuffer(tlutdata.size(), GL_DYNAMIC_DRAW);
+		glBindTexture(GL_TEXTURE_BUFFER, tlut_img);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, tlut_buf);
+		GenTLUT();
+	}
+	SetOutputMode(s_output_mode);
 	printf("Done creating\n");
 
+	if (s_autotune && UsesDecoderVariant(m_type) && tuned == s_tuned_variants.end())
+		Autotune();
+
 	m_cputime.Start();
 	m_avgtime.Start();
 }
 
-void TextureConvert::GenRGB565()
+TextureConvert::~TextureConvert()
 {
-	uint64_t time = m_cputime.End() / 1000;
-	if (time >= 2000)
+	for (GLuint tex : { enc_img, dec_img, bc1_img, tlut_img, idx_img, mip_img, narrow_img })
+		m_pool->ReleaseTexture(tex);
+	for (GLuint buf : { enc_buf, bc1_buf, tlut_buf, dec_buf, split_buf })
+		m_pool->ReleaseBuffer(buf);
+	m_pool->ReleaseStreamBuffer(std::move(m_stream));
+	// Resized for every dispatch, so it's no use to anyone else
+	glDeleteBuffers(1, &table_buf);
+}
+
+bool TextureConvert::SetBC1Transcode(bool enable)
+{
+	m_decoded = false;
+	if (!enable || m_type != TexType::TYPE_CMPR || !SupportsBC1() || m_levels > 1)
 	{
-		m_cputime.Start();
+		m_bc1 = false;
+		m_target = GetOwnTarget();
+		return !enable;
+	}
 
-		m_shift_val <<= 1;
-		if (m_shift_val > m_w)
-			m_shift_val = 1;
+	m_bc1 = true;
+	if (bc1_img)
+	{
+		m_target = bc1_img;
+		return true;
+	}
 
-		for (int y = 0; y < m_h; ++y)
-			for (int x = 0; x < m_w; ++x)
-			{
-				int i = (y * m_w + x) * 2;
-				if (x & m_shift_val)
-					*(uint16_t*)&data[i] = 0xE0FF;
-				else
-					*(uint16_t*)&data[i] = 0xFF07;
+	const int bc1_size = ((m_w + 3) / 4) * ((m_h + 3) / 4) * 8;
+	bc1data.resize(bc1_size);
 
-			}
+	// Written by the transcode shader, then read back as the unpack buffer for the upload
+	bc1_buf = m_pool->GetBuffer(bc1_size, GL_STREAM_COPY);
+	bc1_img = m_pool->GetTexture(GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, m_w, m_h, 1);
+	m_target = bc1_img;
+	return true;
+}
 
-		glBindBuffer(GL_TEXTURE_BUFFER, enc_buf);
-		glBufferData(GL_TEXTURE_BUFFER, data.size(), &data[0], GL_STREAM_DRAW);
+void TextureConvert::SetTLUT(const uint8_t* tlut, TlutFormat fmt)
+{
+	if (!IsPaletted(m_type))
+		return;
+
+	m_tlut_fmt = fmt;
+	std::copy(tlut, tlut + tlutdata.size(), tlutdata.begin());
+	glBindBuffer(GL_TEXTURE_BUFFER, tlut_buf);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, tlutdata.size(), &tlutdata[0]);
+	m_tlut_dirty = true;
+}
+
+bool TextureConvert::SetNarrowOutput(bool enable)
+{
+	m_decoded = false;
+	const DecodedFormat narrow = GetNarrowFormat(m_type);
+	if (!enable || narrow == DecodedFormat::RGBA8 || m_levels > 1)
+	{
+		m_decoded_format = DecodedFormat::RGBA8;
+		m_target = GetOwnTarget();
+		return !enable;
+	}
+
+	m_decoded_format = narrow;
+	if (!narrow_img)
+	{
+		narrow_img = m_pool->GetTexture(GetGLTexFormat(narrow).internal_format, m_w, m_h, 1);
+		glBindTexture(GL_TEXTURE_2D, narrow_img);
+		SetDecodedSwizzle(narrow);
 	}
+	// Whatever the output mode, nothing can imageStore to these formats
+	ReserveDecodeBuffer(GetDecodedPitch(narrow, m_w) * m_h);
+	m_target = narrow_img;
+	return true;
 }
 
-void TextureConvert::DecodeImage()
+bool TextureConvert::SetDeferredTLUT(bool enable)
 {
-	int64_t time1, time2, time3, time4;
-	GenRGB565();
-	glBindImageTexture(0, enc_img, 0, false, 0, GL_READ_ONLY, GL_RGBA16UI);
-	glBindImageTexture(1, dec_img, 0, false, 0, GL_WRITE_ONLY, GL_RGBA8UI);
+	if (!enable || !IsPaletted(m_type) || m_levels > 1)
+	{
+		m_deferred_tlut = false;
+		return !enable;
+	}
+
+	m_deferred_tlut = true;
+	m_indices_dirty = m_cpu_indices_dirty = true;
+	if (idx_img)
+		return true;
+
+	cpuindices.resize(m_w * m_h);
+	idx_img = m_pool->GetTexture(GL_R32UI, m_w, m_h, 1);
+	return true;
+}
+
+void TextureConvert::ApplyTLUTOnGPU(const std::vector<TexRect>& rects, bool partial)
+{
+	const std::vector<TexRect> whole = { { 0, 0, m_w, m_h } };
+	// Anything outside rects only has the current TLUT applied if neither changed since
+	const bool apply_all = m_indices_dirty || m_tlut_dirty;
+
+	// Indices only need decoding again where the encoded data changed
+	if (m_indices_dirty || partial)
+	{
+		GLuint pgm = GenerateDecoderProgram(m_type, m_variant, m_output, true);
+		glUseProgram(pgm);
+		SetDecodeUniforms(pgm);
+		for (const TexRect& rect : m_indices_dirty ? whole : rects)
+			Dispatch(pgm, rect);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		m_indices_dirty = false;
+		m_timer.Mark("indices");
+	}
 
-	GLuint pgm = GenerateDecoderProgram(m_type);
+	GLuint pgm = GenerateTLUTApplyProgram(m_output);
 	glUseProgram(pgm);
+	SetDecodeUniforms(pgm);
+	glUniform1ui(glGetUniformLocation(pgm, "tlut_format"), (GLuint)m_tlut_fmt);
+	for (const TexRect& rect : apply_all ? whole : rects)
+	{
+		glUniform2ui(glGetUniformLocation(pgm, "origin"), rect.x, rect.y);
+		glDispatchCompute((rect.w + 7) / 8, (rect.h + 7) / 8, 1);
+	}
+	m_tlut_dirty = false;
+}
 
+bool TextureConvert::HasCPUPass(CPUKernel kernel) const
+{
+	if (m_bc1)
+		return kernel <= CPUKernel::SSE2;
+	if (m_deferred_tlut)
+		// A table lookup, nothing to vectorize
+		return kernel == CPUKernel::SCALAR;
+	return true;
+}
 
-	mSampler.BindSampler(9);
-	glActiveTexture(GL_TEXTURE9);
-	glBindTexture(GL_TEXTURE_BUFFER, enc_img);
+void TextureConvert::TranscodeOnGPU(const std::vector<TexRect>& rects)
+{
+	GLuint pgm = GenerateBC1TranscodeProgram();
+	glUseProgram(pgm);
+	SetDecodeUniforms(pgm);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, bc1_buf);
+	for (const TexRect& rect : rects)
+		Dispatch(pgm, rect);
+	m_timer.Mark("transcode");
 
-	m_timer.BeginTimer();
-	DispatchType(m_type, m_w, m_h);
-	m_timer.EndTimer();
+	glMemoryBarrier(GL_PIXEL_BUFFER_BARRIER_BIT);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, bc1_buf);
+	glBindTexture(GL_TEXTURE_2D, m_target);
+	// Blocks are in rows of the whole texture, so a rect narrower than that goes up a block row at a time
+	const int pitch = (m_w + 3) / 4;
+	for (const TexRect& rect : rects)
+	{
+		const int w = std::min(rect.w, m_w - rect.x), h = std::min(rect.h, m_h - rect.y);
+		const int rows = rect.x == 0 && w == m_w ? 1 : (h + 3) / 4;
+		const int row_h = rows == 1 ? h : 4;
+		for (int row = 0; row < rows; ++row)
+		{
+			const int y = rect.y + row * 4;
+			const size_t offset = ((size_t)(y / 4) * pitch + rect.x / 4) * 8;
+			const int upload_h = std::min(row_h, m_h - y);
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, y, w, upload_h, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
+				((upload_h + 3) / 4 - 1) * pitch * 8 + (w + 3) / 4 * 8, (const void*)offset);
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
 
-	time1 = CPUTimer::GetTime();
-		DecodeOnCPU<false>(&cpudata[0], &data[0], m_w, m_h, m_type);
-	time2 = CPUTimer::GetTime();
+void TextureConvert::GenData()
+{
+	uint64_t time = m_cputime.End() / 1000;
+	if (time >= 2000)
+	{
+		m_cputime.Start();
 
-	time3 = CPUTimer::GetTime();
-		DecodeOnCPU<true>(&cpudata[0], &data[0], m_w, m_h, m_type);
-	time4 = CPUTimer::GetTime();
+		m_shift_val <<= 1;
+		if (m_shift_val > m_w)
+			m_shift_val = 1;
 
+		if (m_type == TexType::TYPE_RGB565)
+		{
+			for (int y = 0; y < m_h; ++y)
+				for (int x = 0; x < m_w; ++x)
+				{
+					int i = (y * m_w + x) * 2;
+					if (x & m_shift_val)
+						*(uint16_t*)&data[i] = 0xE0FF;
+					else
+						*(uint16_t*)&data[i] = 0xFF07;
 
-	uint64_t time = m_timer.GetTime();
+				}
+		}
+		else
+		{
+			// Stripes of whole blocks
+			const int block_bytes = GetTexInfo(m_type).block_bytes;
+			for (size_t i = 0; i < data.size(); ++i)
+				data[i] = ((i / block_bytes) & m_shift_val) ? 0xF0 : 0x3C;
+		}
 
-	num_times++;
-	totaltime_gpu += time;
-	totaltime_cpu += (time2 - time1);
-	totaltime_cpusse += (time4 - time3);
-	uint64_t total_avg = m_avgtime.End();
+		m_indices_dirty = m_cpu_indices_dirty = true;
+	}
+}
 
-	if (total_avg >= (1000 * 1000))
+void TextureConvert::UploadData()
+{
+	const uint64_t start = CPUTimer::GetTime();
+	if (m_stream)
+	{
+		memcpy(m_stream->Map(), &data[0], data.size());
+		m_resident = false;
+		BindEncodedBuffer();
+	}
+	else
 	{
-		printf("Compute shader took: %ldus(%ldms) GPU time (%ldus(%ldms) CPU time) (%ldus(%ldms) SSE CPU time) %ld runs in %ldms\n",
-			(totaltime_gpu / num_times) / 1000, (totaltime_gpu / num_times) / 1000 / 1000,
-			(totaltime_cpu / num_times), (totaltime_cpu / num_times) / 1000,
-			(totaltime_cpusse / num_times), (totaltime_cpusse / num_times) / 1000,
-			num_times, total_avg / 1000);
+		glBindBuffer(GL_TEXTURE_BUFFER, enc_buf);
+		glBufferData(GL_TEXTURE_BUFFER, data.size(), &data[0], GL_STREAM_DRAW);
+		m_resident = true;
+	}
+	totaltime_upload += CPUTimer::GetTime() - start;
+	upload_bytes += data.size();
+}
 
-		num_times = 0;
-		totaltime_gpu = totaltime_cpu = totaltime_cpusse = 0;
-		m_avgtime.Start();
+void TextureConvert::UploadDirty()
+{
+	const uint64_t start = CPUTimer::GetTime();
+	glBindBuffer(GL_TEXTURE_BUFFER, enc_buf);
+	if (!m_resident)
+	{
+		// Ring segments only ever get whole textures, the first incremental update
+		// moves over to enc_buf and patches it from then on
+		glBufferData(GL_TEXTURE_BUFFER, data.size(), &data[0], GL_DYNAMIC_DRAW);
+		m_resident = true;
+		BindEncodedBuffer();
+		upload_bytes += data.size();
+	}
+	else
+	{
+		const TexInfo info = GetTexInfo(m_type);
+		const int tiles_w = (m_w + info.block_w - 1) / info.block_w;
+		for (const TexRect& rect : m_dirty)
+			for (int ty = rect.y / info.block_h; ty < (rect.y + rect.h) / info.block_h; ++ty)
+			{
+				const size_t offset = ((size_t)ty * tiles_w + rect.x / info.block_w) * info.block_bytes;
+				const size_t size = (size_t)rect.w / info.block_w * info.block_bytes;
+				glBufferSubData(GL_TEXTURE_BUFFER, offset, size, &data[offset]);
+				upload_bytes += size;
+			}
 	}
+	totaltime_upload += CPUTimer::GetTime() - start;
 }
 
+void TextureConvert::BindEncodedBuffer()
+{
+	glBindTexture(GL_TEXTURE_BUFFER, enc_img);
+	if (m_stream && !m_resident)
+		glTexBufferRange(GL_TEXTURE_BUFFER, GetEncodedBufferFormat(m_type, m_variant),
+			m_stream->GetBuffer(), m_stream->GetOffset(), data.size());
+	else
+		glTexBuffer(GL_TEXTURE_BUFFER, GetEncodedBufferFormat(m_type, m_variant), enc_buf);
+}
+
+// A ramp over the whole 16-bit range
+static std::vector<uint8_t> GenRampTLUT(TexType type)
+{
+	const int entries = GetPaletteSize(type);
+	std::vector<uint8_t> tlut(entries * 2);
+	for (int i = 0; i < entries; ++i)
+	{
+		uint16_t val = i * (0x10000 / entries);
+		tlut[2 * i] = val >> 8;
+		tlut[2 * i + 1] = val & 0xFF;
+	}
+	return tlut;
+}
+
+void TextureConvert::GenTLUT()
+{
+	SetTLUT(&GenRampTLUT(m_type)[0], m_tlut_fmt);
+}
+
+void TextureConvert::SetEncodedData(const uint8_t* src)
+{
+	std::copy(src, src + data.size(), data.begin());
+	UploadData();
+	m_indices_dirty = m_cpu_indices_dirty = true;
+	m_decoded = false;
+	m_dirty.clear();
+}
+
+void TextureConvert::MarkDirty(int x, int y, int w, int h)
+{
+	const TexInfo info = GetTexInfo(m_type);
+	const int x1 = std::min(x + w, m_w), y1 = std::min(y + h, m_h);
+	x = std::max(x, 0) / info.block_w * info.block_w;
+	y = std::max(y, 0) / info.block_h * info.block_h;
+	if (x1 <= x || y1 <= y)
+		return;
+	m_dirty.push_back({ x, y,
+		(x1 - x + info.block_w - 1) / info.block_w * info.block_w,
+		(y1 - y + info.block_h - 1) / info.block_h * info.block_h });
+}
+
+void TextureConvert::UpdateEncodedRange(const uint8_t* src, size_t offset, size_t size)
+{
+	size = std::min(size, data.size() - std::min(offset, data.size()));
+	if (!size)
+		return;
+	std::copy(src, src + size, data.begin() + offset);
+
+	// Tiles are stored in rows, so a range is the end of one row, whole rows and the start of another
+	const TexInfo info = GetTexInfo(m_type);
+	const int tiles_w = (m_w + info.block_w - 1) / info.block_w;
+	const int first = offset / info.block_bytes, last = (offset + size - 1) / info.block_bytes;
+	const int row0 = first / tiles_w, row1 = last / tiles_w;
+	const int col0 = first % tiles_w, col1 = last % tiles_w;
+	if (row0 == row1)
+	{
+		MarkDirty(col0 * info.block_w, row0 * info.block_h, (col1 - col0 + 1) * info.block_w, info.block_h);
+		return;
+	}
+	MarkDirty(col0 * info.block_w, row0 * info.block_h, (tiles_w - col0) * info.block_w, info.block_h);
+	if (row1 > row0 + 1)
+		MarkDirty(0, (row0 + 1) * info.block_h, m_w, (row1 - row0 - 1) * info.block_h);
+	MarkDirty(0, row1 * info.block_h, (col1 + 1) * info.block_w, info.block_h);
+}
+
+void TextureConvert::UpdateEncodedRect(const uint8_t* src, int x, int y, int w, int h)
+{
+	const size_t first = m_dirty.size();
+	MarkDirty(x, y, w, h);
+	if (m_dirty.size() == first)
+		return;
+
+	const TexRect& rect = m_dirty.back();
+	const TexInfo info = GetTexInfo(m_type);
+	const int tiles_w = (m_w + info.block_w - 1) / info.block_w;
+	const size_t row_size = (size_t)rect.w / info.block_w * info.block_bytes;
+	for (int ty = rect.y / info.block_h; ty < (rect.y + rect.h) / info.block_h; ++ty)
+	{
+		const size_t offset = ((size_t)ty * tiles_w + rect.x / info.block_w) * info.block_bytes;
+		std::copy(src + offset, src + offset + row_size, data.begin() + offset);
+	}
+}
+
+void TextureConvert::DecodeDirtyOnGPU()
+{
+	// Only base level tiles are tracked, a chain goes up and is decoded whole
+	if (m_levels > 1)
+	{
+		UploadData();
+		DecodeOnGPU();
+		m_cpu_indices_dirty = true;
+		m_dirty.clear();
+		return;
+	}
+
+	const TexInfo info = GetTexInfo(m_type);
+	const uint64_t tiles = (uint64_t)((m_w + info.block_w - 1) / info.block_w) * ((m_h + info.block_h - 1) / info.block_h);
+	uint64_t dirty = 0;
+	for (const TexRect& rect : m_dirty)
+		dirty += (uint64_t)(rect.w / info.block_w) * (rect.h / info.block_h);
+	const GLuint own = GetOwnTarget();
+	const bool new_tlut = IsPaletted(m_type) && m_tlut_dirty;
+	if (m_dirty.empty() && m_decoded && m_target == own && !new_tlut)
+		return;
+
+	UploadDirty();
+
+	// A cached texture doesn't hold the rest of this one, and past a point one dispatch is cheaper.
+	// Deferred TLUT applies a new palette everywhere by itself.
+	if (!m_decoded || m_target != own || dirty >= tiles || (new_tlut && !m_deferred_tlut))
+	{
+		m_target = own;
+		m_indices_dirty = true;
+		DecodeOnGPU();
+		dirty = tiles;
+	}
+	else
+		DecodeRectsOnGPU(m_dirty, true);
+
+	decoded_tiles += dirty;
+	total_tiles += tiles;
+	m_cpu_indices_dirty = true;
+	m_dirty.clear();
+}
+
+void TextureConvert::SetDirtyTilesPerFrame(int tiles)
+{
+	m_dirty_tiles = tiles;
+}
+
+void TextureConvert::GenDirtyTiles()
+{
+	const TexInfo info = GetTexInfo(m_type);
+	const int tiles_w = (m_w + info.block_w - 1) / info.block_w;
+	const int tiles = tiles_w * ((m_h + info.block_h - 1) / info.block_h);
+	for (int i = 0; i < m_dirty_tiles; ++i)
+	{
+		// xorshift32
+		m_dirty_seed ^= m_dirty_seed << 13;
+		m_dirty_seed ^= m_dirty_seed >> 17;
+		m_dirty_seed ^= m_dirty_seed << 5;
+		const int tile = m_dirty_seed % tiles;
+		uint8_t* block = &data[(size_t)tile * info.block_bytes];
+		for (int j = 0; j < info.block_bytes; ++j)
+			block[j] = ~block[j];
+		MarkDirty(tile % tiles_w * info.block_w, tile / tiles_w * info.block_h, info.block_w, info.block_h);
+	}
+}
+
+void TextureConvert::DecodeOnGPU()
+{
+	if (m_levels > 1)
+		DecodeMipChainOnGPU();
+	else
+		DecodeRectsOnGPU({ { 0, 0, m_w, m_h } }, false);
+}
+
+void TextureConvert::DecodeMipChainOnGPU()
+{
+	std::vector<GLuint> levels;
+	GLuint tiles = 0, enc_offset = 0, dec_offset = 0;
+	for (int level = 0; level < m_levels; ++level)
+	{
+		const int w = GetMipSize(m_w, level), h = GetMipSize(m_h, level);
+		AddTileTableEntry(&levels, &tiles, m_type, enc_offset, dec_offset, w, h);
+		enc_offset += GetEncodedSize(m_type, w, h);
+		dec_offset += w * h;
+	}
+
+	GLuint pgm = GenerateTileTableProgram(m_type, m_variant, false);
+	glUseProgram(pgm);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, dec_buf);
+
+	mSampler.BindSampler(9);
+	glActiveTexture(GL_TEXTURE9);
+	glBindTexture(GL_TEXTURE_BUFFER, enc_img);
+	if (IsPaletted(m_type))
+	{
+		glActiveTexture(GL_TEXTURE10);
+		glBindTexture(GL_TEXTURE_BUFFER, tlut_img);
+		glUniform1ui(glGetUniformLocation(pgm, "tlut_format"), (GLuint)m_tlut_fmt);
+	}
+
+	if (!table_buf)
+		glGenBuffers(1, &table_buf);
+	DispatchTileTable(pgm, table_buf, levels, tiles);
+	m_timer.Mark("decode");
+
+	glMemoryBarrier(GL_PIXEL_BUFFER_BARRIER_BIT);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, dec_buf);
+	glBindTexture(GL_TEXTURE_2D, mip_img);
+	for (int level = 0; level < m_levels; ++level)
+		glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, GetMipSize(m_w, level), GetMipSize(m_h, level),
+			GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, (const void*)((size_t)levels[level * 4 + 2] * 4));
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	if (m_stream)
+		m_stream->Fence();
+	m_decoded = true;
+}
+
+int TextureConvert::SetMipLevels(int levels)
+{
+	const int max_levels = std::min(GetMipLevelCount(m_w, m_h), MAX_MIP_LEVELS);
+	levels = levels <= 0 ? max_levels : std::min(levels, max_levels);
+	if (levels == m_levels)
+		return m_levels;
+
+	if (levels > 1)
+	{
+		SetBC1Transcode(false);
+		SetDeferredTLUT(false);
+		SetNarrowOutput(false);
+	}
+	m_levels = levels;
+	m_decoded = false;
+	m_dirty.clear();
+
+	// The base level stays where it was, the rest go after it
+	data.resize(GetMipChainEncodedSize(m_type, m_w, m_h, m_levels));
+	const size_t texels = GetMipChainTexels(m_w, m_h, m_levels);
+	cpudata.resize(std::max(cpudata.size(), texels));
+	m_pool->ReleaseBuffer(enc_buf);
+	enc_buf = m_pool->GetBuffer(data.size(), GL_STREAM_DRAW);
+	if (m_stream)
+	{
+		m_pool->ReleaseStreamBuffer(std::move(m_stream));
+		m_stream = m_pool->GetStreamBuffer(GL_TEXTURE_BUFFER, data.size());
+	}
+	UploadData();
+	BindEncodedBuffer();
+
+	m_pool->ReleaseTexture(mip_img);
+	mip_img = 0;
+	if (m_levels > 1)
+	{
+		mip_img = m_pool->GetTexture(GL_RGBA8UI, m_w, m_h, m_levels);
+		glBindTexture(GL_TEXTURE_2D, mip_img);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+
+		// Every level passes through dec_buf on its way into mip_img
+		ReserveDecodeBuffer(texels * 4);
+	}
+	m_target = GetOwnTarget();
+	return m_levels;
+}
+
+GLuint TextureConvert::GetOwnTarget() const
+{
+	return m_levels > 1 ? mip_img : m_bc1 ? bc1_img : m_decoded_format != DecodedFormat::RGBA8 ? narrow_img : dec_img;
+}
+
+void TextureConvert::DecodeRectsOnGPU(const std::vector<TexRect>& rects, bool partial)
+{
+	// A TLUT change applies everywhere, whatever rects changed
+	const bool whole_output = !partial || (m_deferred_tlut && (m_indices_dirty || m_tlut_dirty));
+	if (IsBufferOutput())
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, dec_buf);
+	else
+		glBindImageTexture(1, m_target, 0, false, 0, GL_WRITE_ONLY, GL_RGBA8UI);
+
+	GLuint pgm = m_decoded_format != DecodedFormat::RGBA8 ?
+		GenerateNarrowProgram(m_type, GetEncodedBufferFormat(m_type, m_variant)) :
+		GenerateDecoderProgram(m_type, m_variant, m_output);
+	glUseProgram(pgm);
+	SetDecodeUniforms(pgm);
+
+	mSampler.BindSampler(9);
+	glActiveTexture(GL_TEXTURE9);
+	glBindTexture(GL_TEXTURE_BUFFER, enc_img);
+
+	if (IsPaletted(m_type))
+	{
+		glActiveTexture(GL_TEXTURE10);
+		glBindTexture(GL_TEXTURE_BUFFER, tlut_img);
+		glUniform1ui(glGetUniformLocation(pgm, "tlut_format"), (GLuint)m_tlut_fmt);
+		if (m_deferred_tlut)
+			glBindImageTexture(2, idx_img, 0, false, 0, GL_READ_WRITE, GL_R32UI);
+	}
+
+	if (m_bc1)
+		TranscodeOnGPU(rects);
+	else if (m_deferred_tlut)
+		ApplyTLUTOnGPU(rects, partial);
+	else
+		for (const TexRect& rect : rects)
+			Dispatch(pgm, rect);
+
+	if (IsBufferOutput() && !m_bc1)
+	{
+		m_timer.Mark(m_deferred_tlut ? "apply" : "decode");
+		CopyOutput(whole_output ? std::vector<TexRect>{ { 0, 0, m_w, m_h } } : rects);
+	}
+	if (!partial)
+	{
+		m_decoded = true;
+		m_tlut_dirty = false;
+	}
+
+	// Done with this ring segment once the dispatch is
+	if (m_stream)
+		m_stream->Fence();
+}
+
+void TextureConvert::SetDecodeUniforms(GLuint pgm)
+{
+	if (m_output == OutputMode::BUFFER)
+		glUniform2i(glGetUniformLocation(pgm, "dec_size"), m_w, m_h);
+	if (m_decoded_format != DecodedFormat::RGBA8)
+		glUniform1ui(glGetUniformLocation(pgm, "row_words"), GetDecodedPitch(m_decoded_format, m_w) / 4);
+	glUniform2ui(glGetUniformLocation(pgm, "dims"), m_w, m_h);
+}
+
+void TextureConvert::CopyOutput(const std::vector<TexRect>& rects)
+{
+	const GLTexFormat format = GetGLTexFormat(m_decoded_format);
+	const size_t pitch = GetDecodedPitch(m_decoded_format, m_w);
+	const int texel_bytes = GetDecodedTexelBytes(m_decoded_format);
+	glMemoryBarrier(GL_PIXEL_BUFFER_BARRIER_BIT);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, dec_buf);
+	glBindTexture(GL_TEXTURE_2D, m_target);
+	// Rows are m_w texels padded out to the default 4 byte unpack alignment
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, m_w);
+	for (const TexRect& rect : rects)
+		glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, std::min(rect.w, m_w - rect.x), std::min(rect.h, m_h - rect.y),
+			format.format, format.type, (const void*)(rect.y * pitch + rect.x * texel_bytes));
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void TextureConvert::SetTextureCache(TextureCache* cache)
+{
+	m_cache = cache;
+	if (!m_cache)
+		m_target = GetOwnTarget();
+}
+
+bool TextureConvert::LookupCache()
+{
+	if (!m_cache)
+		return false;
+	// Cache textures only have the one level
+	if (m_levels > 1)
+	{
+		m_target = mip_img;
+		return false;
+	}
+
+	const uint64_t start = CPUTimer::GetTime();
+	// The TLUT and its format seed the hash of the texture itself
+	uint64_t seed = 0;
+	if (IsPaletted(m_type))
+		seed = XXH64(&tlutdata[0], tlutdata.size(), (uint64_t)m_tlut_fmt);
+	const TextureCache::Key key = {
+		m_type, m_w, m_h, m_bc1 ? (GLenum)GL_COMPRESSED_RGBA_S3TC_DXT1_EXT : GetGLTexFormat(m_decoded_format).internal_format,
+		XXH64(&data[0], data.size(), seed),
+	};
+	totaltime_hash += CPUTimer::GetTime() - start;
+	hash_bytes += data.size();
+
+	bool hit;
+	m_target = m_cache->Get(key, &hit);
+	if (!hit)
+		SetDecodedSwizzle(m_decoded_format);
+	return hit;
+}
+
+void TextureConvert::SetDefaultOutputMode(OutputMode mode)
+{
+	s_output_mode = mode;
+}
+
+void TextureConvert::SetOutputMode(OutputMode mode)
+{
+	if (mode == OutputMode::AUTO)
+	{
+		if (s_device_output == OutputMode::AUTO)
+			s_device_output = MeasureOutputMode();
+		mode = s_device_output;
+	}
+
+	m_output = mode;
+	if (m_output == OutputMode::BUFFER)
+		ReserveDecodeBuffer((size_t)m_w * m_h * 4);
+}
+
+void TextureConvert::SetTexturePool(TexturePool* pool)
+{
+	s_pool = pool;
+}
+
+void TextureConvert::ReserveDecodeBuffer(size_t size)
+{
+	if (size <= dec_buf_size)
+		return;
+
+	m_pool->ReleaseBuffer(dec_buf);
+	dec_buf = m_pool->GetBuffer(size, GL_STREAM_COPY);
+	dec_buf_size = size;
+}
+
+// Decodes whatever this was created with both ways, copy included
+OutputMode TextureConvert::MeasureOutputMode()
+{
+	const int iterations = 8;
+	uint64_t fastest[2] = {};
+	const OutputMode modes[2] = { OutputMode::IMAGE, OutputMode::BUFFER };
+	for (int i = 0; i < 2; ++i)
+	{
+		SetOutputMode(modes[i]);
+		// Compile and warm up untimed
+		DecodeOnGPU();
+
+		GPUTimer timer(iterations);
+		for (int j = 0; j < iterations; ++j)
+		{
+			timer.BeginTimer();
+			DecodeOnGPU();
+			timer.EndTimer();
+		}
+		glFinish();
+
+		GPUTimer::Result result;
+		while (timer.GetResult(&result))
+			if (!fastest[i] || result.total < fastest[i])
+				fastest[i] = result.total;
+	}
+
+	const OutputMode best = fastest[1] && fastest[1] < fastest[0] ? OutputMode::BUFFER : OutputMode::IMAGE;
+	printf("Output mode: %s (%s %dx%d: imageStore %ldus, buffer + copy %ldus)\n",
+		best == OutputMode::BUFFER ? "buffer" : "image", GetTexInfo(m_type).name, m_w, m_h,
+		fastest[0] / 1000, fastest[1] / 1000);
+	return best;
+}
+
+void TextureConvert::Dispatch(GLuint pgm, const TexRect& rect)
+{
+	glUniform2ui(glGetUniformLocation(pgm, "origin"), rect.x, rect.y);
+	if (m_decoded_format != DecodedFormat::RGBA8)
+	{
+		// 8x8 invocations of a word each
+		const int group_w = 8 * 4 / GetDecodedTexelBytes(m_decoded_format);
+		glDispatchCompute((rect.w + group_w - 1) / group_w, (rect.h + 7) / 8, 1);
+	}
+	else if (UsesDecoderVariant(m_type))
+		DispatchVariant(m_variant, rect.w, rect.h);
+	else
+		DispatchType(m_type, rect.w, rect.h);
+}
+
+void TextureConvert::Autotune(int iterations)
+{
+	if (!UsesDecoderVariant(m_type))
+		return;
+
+	GLint max_invocations = 128;
+	glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &max_invocations);
+
+	const TexInfo info = GetTexInfo(m_type);
+	const DecoderVariant tile_shape = GetDefaultVariant(m_type);
+	const int shapes[][2] = {
+		{ tile_shape.local_x, tile_shape.local_y }, { 8, 8 }, { 16, 4 }, { 16, 8 }, { 32, 4 }, { 64, 1 },
+	};
+	std::vector<DecoderVariant> variants;
+	for (const auto& shape : shapes)
+		for (int texels = 1; texels <= info.block_w; texels *= 2)
+			for (int load_words = 1; load_words <= 4; load_words *= 2)
+			{
+				const DecoderVariant v = { shape[0], shape[1], texels, load_words };
+				if (v.local_x * v.local_y > max_invocations)
+					continue;
+				if (std::any_of(variants.begin(), variants.end(), [&](const DecoderVariant& o)
+					{ return !memcmp(&o, &v, sizeof(v)); }))
+					continue;
+				variants.push_back(v);
+			}
+
+	GenerateDecoderPrograms(m_type, variants, m_output);
+
+	// The TLUT pass doesn't depend on the variant, time the whole decode instead
+	const bool deferred_tlut = m_deferred_tlut;
+	m_deferred_tlut = false;
+
+	DecoderVariant best = m_variant;
+	uint64_t best_time = 0, default_time = 0;
+	for (const DecoderVariant& v : variants)
+	{
+		m_variant = v;
+		BindEncodedBuffer();
+		// Compile and warm up untimed
+		DecodeOnGPU();
+
+		GPUTimer timer(iterations);
+		for (int i = 0; i < iterations; ++i)
+		{
+			timer.BeginTimer();
+			DecodeOnGPU();
+			timer.EndTimer();
+		}
+		glFinish();
+
+		uint64_t fastest = 0;
+		GPUTimer::Result result;
+		while (timer.GetResult(&result))
+			if (!fastest || result.total < fastest)
+				fastest = result.total;
+
+		if (!memcmp(&v, &tile_shape, sizeof(v)))
+			default_time = fastest;
+		if (fastest && (!best_time || fastest < best_time))
+		{
+			best = v;
+			best_time = fastest;
+		}
+	}
+
+	m_deferred_tlut = deferred_tlut;
+	m_indices_dirty = true;
+	m_variant = best;
+	BindEncodedBuffer();
+	if (!best_time)
+	{
+		printf("Autotune %s %dx%d: no GPU times, keeping the %dx%d workgroup\n",
+			info.name, m_w, m_h, best.local_x, best.local_y);
+		return;
+	}
+
+	s_tuned_variants[std::make_pair(m_type, GetSizeClass(m_w, m_h))] = best;
+	printf("Autotune %s %dx%d: %dx%d workgroup, %d texels per invocation, %d word loads, %ldus (one texel per invocation %ldus), %d variants\n",
+		info.name, m_w, m_h, best.local_x, best.local_y, best.texels, best.load_words,
+		best_time / 1000, default_time / 1000, (int)variants.size());
+}
+
+// A CPU backend of the scheduler, any size. Partial tiles take the rect path, and the time
+// observed for the backend includes that.
+static void DecodeOnBackend(const DecodeScheduler::Backend& backend, uint32_t* dst, uint8_t* src, int width, int height,
+                            TexType type, const uint8_t* tlut, TlutFormat tlut_fmt)
+{
+	const TexInfo info = GetTexInfo(type);
+	if (backend.threaded)
+		DecodeOnCPUParallel(backend.kernel, dst, src, width, height, type, tlut, tlut_fmt);
+	else if (width % info.block_w || height % info.block_h)
+		DecodeRectOnCPU(backend.kernel, dst, src, width, height, type, 0, 0, width, height, tlut, tlut_fmt);
+	else
+		DecodeOnCPU(backend.kernel, dst, src, width, height, type, tlut, tlut_fmt);
+}
+
+void TextureConvert::SetScheduler(DecodeScheduler* scheduler)
+{
+	m_scheduler = scheduler;
+	if (!m_scheduler || m_scheduler->IsCalibrated(m_type))
+		return;
+
+	// CPU backends pay for the upload of what they decode. The GPU goes through a BatchConvert
+	// of one texture, which takes any size, and is waited on so its latency counts too.
+	BatchConvert batch(m_type);
+	batch.SetTLUT(tlutdata.data(), m_tlut_fmt);
+	std::vector<uint32_t> texels;
+	GLuint tex = 0;
+	int tex_w = 0, tex_h = 0;
+	m_scheduler->Calibrate(m_type, [&](int backend, uint8_t* src, int width, int height)
+	{
+		const DecodeScheduler::Backend& info = m_scheduler->GetBackends()[backend];
+		if (!info.gpu && (width > tex_w || height > tex_h))
+		{
+			tex_w = std::max(tex_w, width);
+			tex_h = std::max(tex_h, height);
+			texels.resize(tex_w * tex_h);
+			glDeleteTextures(1, &tex);
+			glGenTextures(1, &tex);
+			glBindTexture(GL_TEXTURE_2D, tex);
+			glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8UI, tex_w, tex_h);
+		}
+		glFinish();
+
+		const uint64_t start = CPUTimer::GetTime();
+		if (info.gpu)
+		{
+			batch.Decode({ { src, width, height } });
+			glFinish();
+		}
+		else
+		{
+			DecodeOnBackend(info, &texels[0], src, width, height, m_type, tlutdata.data(), m_tlut_fmt);
+			glBindTexture(GL_TEXTURE_2D, tex);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, &texels[0]);
+		}
+		return (double)(CPUTimer::GetTime() - start);
+	});
+	glDeleteTextures(1, &tex);
+}
+
+void TextureConvert::DecodeScheduled()
+{
+	if (!LookupCache())
+	{
+		const int backend = m_scheduler->Choose(m_type, m_w, m_h);
+		const DecodeScheduler::Backend& info = m_scheduler->GetBackends()[backend];
+		const uint64_t start = CPUTimer::GetTime();
+		if (info.gpu)
+		{
+			UploadData();
+			const bool timed = m_timer.BeginTimer();
+			DecodeOnGPU();
+			m_timer.EndTimer(m_output == OutputMode::BUFFER ? "copy" : "decode");
+			if (timed)
+				m_gpu_submits.push_back(CPUTimer::GetTime() - start);
+		}
+		else
+		{
+			DecodeOnBackend(info, &cpudata[0], &data[0], m_w, m_h, m_type, tlutdata.data(), m_tlut_fmt);
+			glBindTexture(GL_TEXTURE_2D, m_target);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_w, m_h, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, &cpudata[0]);
+			m_scheduler->Observe(m_type, backend, m_w, m_h, CPUTimer::GetTime() - start);
+		}
+	}
+
+	GPUTimer::Result result;
+	while (m_timer.GetResult(&result))
+	{
+		const uint64_t submit = m_gpu_submits.front();
+		m_gpu_submits.pop_front();
+		m_scheduler->Observe(m_type, m_scheduler->GetGPUBackend(), m_w, m_h, submit + result.total / 1000.0);
+	}
+
+	if (m_avgtime.End() >= (1000 * 1000))
+	{
+		m_scheduler->PrintStats(m_type, m_w, m_h);
+		m_avgtime.Start();
+	}
+}
+
+void TextureConvert::SetSplitDecode(bool enable)
+{
+	m_split_decode = enable;
+	if (!enable || split_buf)
+		return;
+
+	// Never more than the whole texture
+	split_buf = m_pool->GetBuffer((size_t)m_w * m_h * 4, GL_STREAM_DRAW);
+}
+
+void TextureConvert::DecodeSplit()
+{
+	// Both sides keep at least a block row, so both keep being measured
+	const TexInfo info = GetTexInfo(m_type);
+	const int block_rows = (m_h + info.block_h - 1) / info.block_h;
+	const int gpu_rows = block_rows < 2 ? block_rows :
+		std::min(std::max((int)(m_split * block_rows + 0.5), 1), block_rows - 1);
+	const int gpu_h = std::min(gpu_rows * info.block_h, m_h);
+
+	if (!LookupCache())
+	{
+		UploadData();
+		if (m_timer.BeginTimer())
+			m_split_rows.push_back(gpu_rows);
+		DecodeRectsOnGPU({ { 0, 0, m_w, gpu_h } }, true);
+		m_timer.EndTimer(m_output == OutputMode::BUFFER ? "copy" : "decode");
+		// Get the GPU going before the CPU starts on its share
+		glFlush();
+
+		if (gpu_h < m_h)
+		{
+			// Rows of tiles follow each other in the encoded data, so the CPU share is a texture of its own.
+			// Its right tile column and bottom tile row can be partial, DecodeOnCPUParallel clips those to
+			// the m_w x cpu_h texels mapped.
+			const int cpu_h = m_h - gpu_h;
+			const uint64_t start = CPUTimer::GetTime();
+			const size_t offset = (size_t)gpu_rows * ((m_w + info.block_w - 1) / info.block_w) * info.block_bytes;
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, split_buf);
+			uint32_t* dst = (uint32_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (size_t)m_w * cpu_h * 4,
+				GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+			DecodeOnCPUParallel(GetBestCPUKernel(), dst, &data[offset], m_w, cpu_h, m_type, tlutdata.data(), m_tlut_fmt);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			glBindTexture(GL_TEXTURE_2D, m_target);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, gpu_h, m_w, cpu_h, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+			const uint64_t time = std::max<uint64_t>(CPUTimer::GetTime() - start, 1);
+			const double rate = (double)(block_rows - gpu_rows) / time;
+			m_cpu_rows_per_us = m_cpu_rows_per_us ? m_cpu_rows_per_us * 0.75 + rate * 0.25 : rate;
+			totaltime_split_cpu += time;
+			num_split_cpu++;
+		}
+	}
+
+	GPUTimer::Result result;
+	while (m_timer.GetResult(&result))
+	{
+		const int rows = m_split_rows.front();
+		m_split_rows.pop_front();
+		const double rate = rows / std::max(result.total / 1000.0, 1.0);
+		m_gpu_rows_per_us = m_gpu_rows_per_us ? m_gpu_rows_per_us * 0.75 + rate * 0.25 : rate;
+		totaltime_split_gpu += result.total;
+		num_split_gpu++;
+	}
+
+	// Rows split so that both sides take as long
+	if (m_gpu_rows_per_us && m_cpu_rows_per_us)
+		m_split = m_gpu_rows_per_us / (m_gpu_rows_per_us + m_cpu_rows_per_us);
+
+	if (m_avgtime.End() >= (1000 * 1000))
+	{
+		printf("Split decode: %d of %d block rows on the GPU %ldus, the rest on %d CPU threads %ldus; alone GPU %.0fus, CPU %.0fus\n",
+			gpu_rows, block_rows,
+			totaltime_split_gpu / std::max<uint64_t>(num_split_gpu, 1) / 1000,
+			GetDecodeThreadCount(), totaltime_split_cpu / std::max<uint64_t>(num_split_cpu, 1),
+			m_gpu_rows_per_us ? block_rows / m_gpu_rows_per_us : 0.0,
+			m_cpu_rows_per_us ? block_rows / m_cpu_rows_per_us : 0.0);
+		totaltime_split_gpu = num_split_gpu = totaltime_split_cpu = num_split_cpu = 0;
+		m_avgtime.Start();
+	}
+}
+
+void TextureConvert::DecodeImage(const uint8_t* src)
+{
+	std::copy(src, src + data.size(), data.begin());
+	m_indices_dirty = m_cpu_indices_dirty = true;
+	if (m_dirty_tiles)
+		MarkDirty(0, 0, m_w, m_h);
+	m_given_data = true;
+	DecodeImage();
+	m_given_data = false;
+}
+
+void TextureConvert::DecodeImage()
+{
+	if (!m_given_data && m_dirty_tiles)
+		GenDirtyTiles();
+	else if (!m_given_data)
+		GenData();
+	if (m_trace)
+		m_trace->AddTexture(m_type, m_w, m_h, m_levels, &data[0], tlutdata.data(), m_tlut_fmt);
+
+	// Split and scheduled decodes are whole single level RGBA8 decodes
+	const bool plain = !m_bc1 && !m_deferred_tlut && m_decoded_format == DecodedFormat::RGBA8 && !m_dirty_tiles && m_levels == 1;
+	if (m_split_decode && plain)
+	{
+		DecodeSplit();
+		return;
+	}
+
+	if (m_scheduler && plain)
+	{
+		DecodeScheduled();
+		return;
+	}
+
+	int64_t time1, time2, time3, time4;
+	const char* last_stage = m_bc1 ? "upload" : IsBufferOutput() || m_levels > 1 ? "copy" :
+		m_deferred_tlut ? "apply" : "decode";
+	std::vector<TexRect> dirty_rects;
+	if (m_dirty_tiles)
+	{
+		// Only some tiles change, the rest stays decoded from earlier frames
+		dirty_rects = m_dirty;
+		m_timer.BeginTimer();
+		DecodeDirtyOnGPU();
+		m_timer.EndTimer(last_stage);
+	}
+	else
+	{
+		// Streams the encoded texture every time, as if it were a new one
+		if (!LookupCache())
+		{
+			UploadData();
+
+			m_timer.BeginTimer();
+			DecodeOnGPU();
+			m_timer.EndTimer(last_stage);
+		}
+	}
+
+	// Deferred TLUT only decodes indices when the encoded data changed
+	const bool new_indices = m_cpu_indices_dirty;
+	m_cpu_indices_dirty = false;
+
+	// Every kernel the host can run, single threaded and band-parallel
+	for (int i = 0; i < (int)CPUKernel::COUNT; ++i)
+	{
+		CPUKernel kernel = (CPUKernel)i;
+		if (!IsCPUKernelSupported(kernel))
+			continue;
+
+		if (!HasCPUPass(kernel))
+			continue;
+
+		if (m_levels > 1)
+		{
+			time1 = CPUTimer::GetTime();
+				DecodeMipChainOnCPU(kernel, &cpudata[0], &data[0], m_w, m_h, m_levels, m_type, tlutdata.data(), m_tlut_fmt);
+			time2 = CPUTimer::GetTime();
+
+			totaltime_cpu[i] += (time2 - time1);
+			continue;
+		}
+
+		if (m_dirty_tiles)
+		{
+			// No rect version of the BC1 transcode, and the rects are too small to split over threads
+			if (m_bc1)
+				continue;
+
+			time1 = CPUTimer::GetTime();
+			for (const TexRect& rect : dirty_rects)
+			{
+				if (!m_deferred_tlut)
+				{
+					DecodeRectOnCPU(kernel, &cpudata[0], &data[0], m_w, m_h, m_type,
+						rect.x, rect.y, rect.w, rect.h, tlutdata.data(), m_tlut_fmt);
+					continue;
+				}
+				DecodeIndicesRectOnCPU(&cpuindices[0], &data[0], m_w, m_h, m_type, rect.x, rect.y, rect.w, rect.h);
+				for (int y = rect.y; y < std::min(rect.y + rect.h, m_h); ++y)
+					ApplyTLUTOnCPU(&cpudata[y * m_w + rect.x], &cpuindices[y * m_w + rect.x],
+						std::min(rect.w, m_w - rect.x), &tlutdata[0], GetPaletteSize(m_type), m_tlut_fmt);
+			}
+			time2 = CPUTimer::GetTime();
+
+			totaltime_cpu[i] += (time2 - time1);
+			continue;
+		}
+
+		if (m_decoded_format != DecodedFormat::RGBA8)
+		{
+			time1 = CPUTimer::GetTime();
+				DecodeNarrowOnCPU(kernel, (uint8_t*)&cpudata[0], &data[0], m_w, m_h, m_type);
+			time2 = CPUTimer::GetTime();
+
+			time3 = CPUTimer::GetTime();
+				DecodeNarrowOnCPUParallel(kernel, (uint8_t*)&cpudata[0], &data[0], m_w, m_h, m_type);
+			time4 = CPUTimer::GetTime();
+
+			totaltime_cpu[i] += (time2 - time1);
+			totaltime_cpu_mt[i] += (time4 - time3);
+			continue;
+		}
+
+		if (m_bc1)
+		{
+			time1 = CPUTimer::GetTime();
+				TranscodeCMPRToBC1(kernel, &bc1data[0], &data[0], m_w, m_h);
+			time2 = CPUTimer::GetTime();
+
+			totaltime_cpu[i] += (time2 - time1);
+			continue;
+		}
+
+		if (m_deferred_tlut)
+		{
+			if (new_indices)
+				DecodeIndicesOnCPU(&cpuindices[0], &data[0], m_w, m_h, m_type);
+
+			time1 = CPUTimer::GetTime();
+				ApplyTLUTOnCPU(&cpudata[0], &cpuindices[0], m_w * m_h, &tlutdata[0], GetPaletteSize(m_type), m_tlut_fmt);
+			time2 = CPUTimer::GetTime();
+
+			totaltime_cpu[i] += (time2 - time1);
+			continue;
+		}
+
+		time1 = CPUTimer::GetTime();
+			DecodeOnCPU(kernel, &cpudata[0], &data[0], m_w, m_h, m_type, tlutdata.data(), m_tlut_fmt);
+		time2 = CPUTimer::GetTime();
+
+		time3 = CPUTimer::GetTime();
+			DecodeOnCPUParallel(kernel, &cpudata[0], &data[0], m_w, m_h, m_type, tlutdata.data(), m_tlut_fmt);
+		time4 = CPUTimer::GetTime();
+
+		totaltime_cpu[i] += (time2 - time1);
+		totaltime_cpu_mt[i] += (time4 - time3);
+	}
+
+	// Whatever earlier frames the GPU has finished by now, never waiting on it
+	GPUTimer::Result result;
+	while (m_timer.GetResult(&result))
+	{
+		num_gpu_times++;
+		totaltime_gpu += result.total;
+		for (int i = 0; i < result.num_stages; ++i)
+		{
+			StageTime& stage = stage_times[result.names[i]];
+			stage.total += result.stages[i];
+			stage.count++;
+		}
+	}
+
+	num_times++;
+	uint64_t total_avg = m_avgtime.End();
+
+	if (total_avg >= (1000 * 1000))
+	{
+		// Decoded bytes per average run, over ns for the GPU and us for the CPU
+		const double decoded = total_tiles ? (double)decoded_tiles / total_tiles : 1.0;
+		const double out_bytes = (m_bc1 ? (double)bc1data.size() : (double)GetMipChainTexels(m_w, m_h, m_levels) * GetDecodedTexelBytes(m_decoded_format)) * decoded;
+
+		const uint64_t gpu_avg = totaltime_gpu / std::max<uint64_t>(num_gpu_times, 1);
+		const std::string output = m_decoded_format != DecodedFormat::RGBA8 ?
+			std::string(" (") + GetDecodedFormatName(m_decoded_format) + " output)" :
+			!m_bc1 && (m_output == OutputMode::BUFFER || m_levels > 1) ? " (buffer output)" : "";
+		printf("%s%s took: %ldus(%ldms) GPU time (%.2fGB/s) %ld runs in %ldms, %ld timed, %ld dropped\n",
+			m_bc1 ? "BC1 transcode + upload" : m_deferred_tlut ? "TLUT apply" : m_levels > 1 ? "Mip chain" : "Compute shader",
+			output.c_str(),
+			gpu_avg / 1000, gpu_avg / 1000 / 1000,
+			out_bytes * num_gpu_times / std::max<uint64_t>(totaltime_gpu, 1),
+			num_times, total_avg / 1000, num_gpu_times, m_timer.GetDropped() - dropped_gpu_times);
+		if (stage_times.size() > 1)
+		{
+			printf("\tGPU stages:");
+			for (const auto& stage : stage_times)
+				printf(" %s %ldus (%ld runs)", stage.first.c_str(),
+					stage.second.total / stage.second.count / 1000, stage.second.count);
+			printf("\n");
+		}
+		printf("Upload (%s): %.2fMB/s, %ld stalls waiting %ldus\n",
+			m_stream ? "persistent ring" : "glBufferData",
+			(double)upload_bytes / std::max<uint64_t>(totaltime_upload, 1),
+			m_stream ? m_stream->GetStalls() : 0, m_stream ? m_stream->GetStallTime() : 0);
+		if (m_cache)
+		{
+			const TextureCache::Stats& stats = m_cache->GetStats();
+			printf("Texture cache: %ld hits, %ld misses, %ld evictions, %d textures in %.1f/%.1fMB, hashing %.2fGB/s\n",
+				stats.hits, stats.misses, stats.evictions, stats.entries,
+				stats.used / (1024.0 * 1024.0), stats.budget / (1024.0 * 1024.0),
+				(double)hash_bytes / std::max<uint64_t>(totaltime_hash, 1) / 1000);
+		}
+		if (total_tiles)
+			printf("Dirty tiles: %.1f%% of tiles decoded (%ld of %ld)\n",
+				decoded * 100, decoded_tiles, total_tiles);
+		for (int i = 0; i < (int)CPUKernel::COUNT; ++i)
+		{
+			CPUKernel kernel = (CPUKernel)i;
+			if (!IsCPUKernelSupported(kernel))
+				continue;
+
+			if (m_bc1 || m_deferred_tlut || m_dirty_tiles || m_levels > 1)
+			{
+				if (HasCPUPass(kernel) && !(m_bc1 && m_dirty_tiles))
+					printf("\t%-6s : %ldus(%ldms) CPU %s (%.2fGB/s)\n",
+						GetCPUKernelName(kernel),
+						(totaltime_cpu[i] / num_times), (totaltime_cpu[i] / num_times) / 1000,
+						m_levels > 1 ? "mip chain" : m_dirty_tiles ? "dirty tiles" : m_bc1 ? "BC1 transcode" : "TLUT apply",
+						out_bytes * num_times / std::max<uint64_t>(totaltime_cpu[i], 1) / 1000);
+				continue;
+			}
+
+			printf("\t%-6s%s: %ldus(%ldms) CPU time (%.2fGB/s), %d threads: %ldus(%ldms) (%.2fGB/s, %.2fx)\n",
+				GetCPUKernelName(kernel), kernel == GetBestCPUKernel() ? "*" : " ",
+				(totaltime_cpu[i] / num_times), (totaltime_cpu[i] / num_times) / 1000,
+				out_bytes * num_times / std::max<uint64_t>(totaltime_cpu[i], 1) / 1000,
+				GetDecodeThreadCount(),
+				(totaltime_cpu_mt[i] / num_times), (totaltime_cpu_mt[i] / num_times) / 1000,
+				out_bytes * num_times / std::max<uint64_t>(totaltime_cpu_mt[i], 1) / 1000,
+				(double)totaltime_cpu[i] / std::max<uint64_t>(totaltime_cpu_mt[i], 1));
+		}
+
+		num_times = num_gpu_times = 0;
+		dropped_gpu_times = m_timer.GetDropped();
+		stage_times.clear();
+		totaltime_gpu = 0;
+		totaltime_upload = upload_bytes = 0;
+		totaltime_hash = hash_bytes = 0;
+		decoded_tiles = total_tiles = 0;
+		if (m_stream)
+			m_stream->ResetStats();
+		totaltime_cpu.fill(0);
+		totaltime_cpu_mt.fill(0);
+		m_avgtime.Start();
+	}
+}
+
+BatchConvert::BatchConvert(TexType type)
+	: m_type(type)
+{
+	GLuint buffers[2];
+	glGenBuffers(2, buffers);
+	enc_buf = buffers[0];
+	table_buf = buffers[1];
+	glGenTextures(1, &enc_img);
+	glBindBuffer(GL_TEXTURE_BUFFER, enc_buf);
+	glBufferData(GL_TEXTURE_BUFFER, GetTexInfo(m_type).block_bytes, nullptr, GL_STREAM_DRAW);
+	glBindTexture(GL_TEXTURE_BUFFER, enc_img);
+	glTexBuffer(GL_TEXTURE_BUFFER, GetEncodedBufferFormat(m_type, GetDefaultVariant(m_type)), enc_buf);
+
+	if (IsPaletted(m_type))
+	{
+		glGenTextures(1, &tlut_img);
+		glGenBuffers(1, &tlut_buf);
+		tlutdata.resize(GetPaletteSize(m_type) * 2);
+		glBindBuffer(GL_TEXTURE_BUFFER, tlut_buf);
+		glBufferData(GL_TEXTURE_BUFFER, tlutdata.size(), nullptr, GL_DYNAMIC_DRAW);
+		glBindTexture(GL_TEXTURE_BUFFER, tlut_img);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, tlut_buf);
+		SetTLUT(&GenRampTLUT(m_type)[0], m_tlut_fmt);
+	}
+	m_avgtime.Start();
+}
+
+BatchConvert::~BatchConvert()
+{
+	const GLuint textures[] = { enc_img, array_img, tlut_img };
+	const GLuint buffers[] = { enc_buf, table_buf, tlut_buf };
+	glDeleteTextures(3, textures);
+	glDeleteBuffers(3, buffers);
+}
+
+void BatchConvert::SetTLUT(const uint8_t* tlut, TlutFormat fmt)
+{
+	if (!IsPaletted(m_type))
+		return;
+
+	m_tlut_fmt = fmt;
+	std::copy(tlut, tlut + tlutdata.size(), tlutdata.begin());
+	glBindBuffer(GL_TEXTURE_BUFFER, tlut_buf);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, tlutdata.size(), &tlutdata[0]);
+}
+
+void BatchConvert::Decode(const std::vector<DecodeJob>& jobs)
+{
+	if (jobs.empty())
+		return;
+
+	// Back to back, every texture is whole tiles so each one starts on a fetch
+	m_table.clear();
+	GLuint tiles = 0, size = 0;
+	int w = m_array_w, h = m_array_h;
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		AddTileTableEntry(&m_table, &tiles, m_type, size, i, jobs[i].width, jobs[i].height);
+		size += GetEncodedSize(m_type, jobs[i].width, jobs[i].height);
+		w = std::max(w, jobs[i].width);
+		h = std::max(h, jobs[i].height);
+	}
+
+	glBindBuffer(GL_TEXTURE_BUFFER, enc_buf);
+	glBufferData(GL_TEXTURE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+	uint8_t* dst = (uint8_t*)glMapBufferRange(GL_TEXTURE_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	for (size_t i = 0; i < jobs.size(); ++i)
+		memcpy(dst + m_table[i * 4 + 1], jobs[i].src, GetEncodedSize(m_type, jobs[i].width, jobs[i].height));
+	glUnmapBuffer(GL_TEXTURE_BUFFER);
+
+	if (w > m_array_w || h > m_array_h || (int)jobs.size() > m_layers)
+	{
+		m_array_w = w;
+		m_array_h = h;
+		m_layers = std::max(m_layers, (int)jobs.size());
+		if (array_img)
+			glDeleteTextures(1, &array_img);
+		glGenTextures(1, &array_img);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, array_img);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8UI, m_array_w, m_array_h, m_layers);
+	}
+
+	GLuint pgm = GenerateTileTableProgram(m_type, GetDefaultVariant(m_type), true);
+	glUseProgram(pgm);
+	glBindImageTexture(1, array_img, 0, true, 0, GL_WRITE_ONLY, GL_RGBA8UI);
+
+	mSampler.BindSampler(9);
+	glActiveTexture(GL_TEXTURE9);
+	glBindTexture(GL_TEXTURE_BUFFER, enc_img);
+	if (IsPaletted(m_type))
+	{
+		glActiveTexture(GL_TEXTURE10);
+		glBindTexture(GL_TEXTURE_BUFFER, tlut_img);
+		glUniform1ui(glGetUniformLocation(pgm, "tlut_format"), (GLuint)m_tlut_fmt);
+	}
+
+	DispatchTileTable(pgm, table_buf, m_table, tiles);
+}
+
+void BatchConvert::GenJobs(int count)
+{
+	m_srcs.resize(count);
+	m_jobs.resize(count);
+	m_cpu_jobs.resize(count);
+	size_t texels = 0;
+	uint32_t seed = 1;
+	for (int i = 0; i < count; ++i)
+	{
+		const int size = 32 << (i % 3);
+		m_srcs[i].resize(GetEncodedSize(m_type, size, size));
+		for (uint8_t& b : m_srcs[i])
+		{
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			b = seed;
+		}
+		m_jobs[i] = { &m_srcs[i][0], size, size };
+		texels += size * size;
+	}
+
+	cpudata.resize(texels);
+	texels = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		m_cpu_jobs[i] = { &cpudata[texels], &m_srcs[i][0], m_jobs[i].width, m_jobs[i].height };
+		texels += m_jobs[i].width * m_jobs[i].height;
+	}
+}
+
+void BatchConvert::DecodeImages(int count)
+{
+	if ((int)m_jobs.size() != count)
+		GenJobs(count);
+
+	// The same shader both ways, only the binds, uploads and dispatches per texture differ
+	const uint64_t start = CPUTimer::GetTime();
+	m_timer.BeginTimer();
+	for (const DecodeJob& job : m_jobs)
+		Decode({ job });
+	m_timer.Mark("one at a time");
+	const uint64_t batch_start = CPUTimer::GetTime();
+	Decode(m_jobs);
+	m_timer.EndTimer("batched");
+	const uint64_t end = CPUTimer::GetTime();
+	totaltime_submit_single += batch_start - start;
+	totaltime_submit += end - batch_start;
+
+	const CPUKernel kernel = GetBestCPUKernel();
+	const uint64_t cpu_start = CPUTimer::GetTime();
+	for (const CPUDecodeJob& job : m_cpu_jobs)
+		DecodeOnCPUParallel(kernel, job.dst, job.src, job.width, job.height, m_type, tlutdata.data(), m_tlut_fmt);
+	const uint64_t cpu_batch_start = CPUTimer::GetTime();
+	DecodeBatchOnCPUParallel(kernel, &m_cpu_jobs[0], count, m_type, tlutdata.data(), m_tlut_fmt);
+	const uint64_t cpu_end = CPUTimer::GetTime();
+	totaltime_cpu_single += cpu_batch_start - cpu_start;
+	totaltime_cpu += cpu_end - cpu_batch_start;
+
+	GPUTimer::Result result;
+	while (m_timer.GetResult(&result))
+	{
+		if (result.num_stages < 2)
+			continue;
+		num_gpu_times++;
+		totaltime_gpu_single += result.stages[0];
+		totaltime_gpu += result.stages[1];
+	}
+
+	num_times++;
+	if (m_avgtime.End() < 1000 * 1000)
+		return;
+
+	const uint64_t gpu_runs = std::max<uint64_t>(num_gpu_times, 1);
+	printf("Batch of %d %s textures: GPU %ldus batched, %ldus one at a time (submitting %ldus, %ldus)\n",
+		count, GetTexInfo(m_type).name, totaltime_gpu / gpu_runs / 1000, totaltime_gpu_single / gpu_runs / 1000,
+		totaltime_submit / num_times, totaltime_submit_single / num_times);
+	printf("\t%-6s: %ldus batched, %ldus one at a time, %d threads\n",
+		GetCPUKernelName(kernel), totaltime_cpu / num_times, totaltime_cpu_single / num_times, GetDecodeThreadCount());
+
+	num_times = num_gpu_times = 0;
+	totaltime_gpu = totaltime_gpu_single = totaltime_submit = totaltime_submit_single = 0;
+	totaltime_cpu = totaltime_cpu_single = 0;
+	m_avgtime.Start();
+}
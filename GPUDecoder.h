@@ -1,30 +1,242 @@
 #pragma once
+#include "CPUDecoder.h"
+#include "DecodeScheduler.h"
 #include "DecodeTypes.h"
 #include "GPUTimer.h"
 #include "Sampler.h"
+#include "StreamBuffer.h"
+#include "TextureCache.h"
+#include "TexturePool.h"
+#include "Trace.h"
 
+#include <array>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
 #include <stdint.h>
 
+// Shape of the generated shader for the formats decoded texel by texel,
+// everything but RGBA8 and CMPR
+struct DecoderVariant
+{
+	// Invocations per workgroup
+	int local_x, local_y;
+	// Consecutive texels of a tile row decoded by each invocation
+	int texels;
+	// 32-bit words per texel fetch: 1, 2 or 4
+	int load_words;
+};
+
+// Where the decode shaders write their texels. Both end up in the same rgba8ui texture,
+// BUFFER writes packed texels to an SSBO and copies that in through the unpack buffer.
+enum class OutputMode
+{
+	AUTO,
+	IMAGE,
+	BUFFER,
+};
+
+// Texels, x and y aligned to the tile size of the format
+struct TexRect
+{
+	int x, y, w, h;
+};
+
+bool UsesDecoderVariant(TexType type);
+// One workgroup per tile and one texel per invocation
+DecoderVariant GetDefaultVariant(TexType type);
+
 class TextureConvert
 {
 public:
 	TextureConvert(TexType type, int w, int h);
+	~TextureConvert();
 
+	// Generates test data, decodes on the GPU and every CPU kernel, and prints timings
 	void DecodeImage();
+	// The same with src instead of generated data, GetMipChainEncodedSize() bytes
+	void DecodeImage(const uint8_t* src);
+	// Just the GPU decode of whatever was last uploaded, untimed
+	void DecodeOnGPU();
+	// Replaces the generated test data, src is GetEncodedSize() bytes
+	void SetEncodedData(const uint8_t* src);
+
+	// Replace part of the encoded data and only upload and decode the tiles it covers on the
+	// next DecodeDirtyOnGPU. src holds size bytes to go at offset in the encoded data.
+	void UpdateEncodedRange(const uint8_t* src, size_t offset, size_t size);
+	// src is GetEncodedSize() bytes, only the tiles covering the texel rect are taken from it
+	void UpdateEncodedRect(const uint8_t* src, int x, int y, int w, int h);
+	// Everything is decoded if no full decode of the current target happened yet
+	void DecodeDirtyOnGPU();
+	// DecodeImage rewrites this many random tiles per frame instead of the whole texture, 0 is off
+	void SetDirtyTilesPerFrame(int tiles);
+
+	// CMPR only: transcode to BC1 and upload that instead of decoding to RGBA8.
+	// Fails, leaving the RGBA8 decode in place, when the driver has no S3TC support.
+	bool SetBC1Transcode(bool enable);
+	bool IsBC1Transcode() const { return m_bc1; }
+
+	// Paletted formats only. tlut is GetPaletteSize() big-endian 16-bit entries, only the
+	// small TLUT buffer is updated so swapping palettes is cheap with SetDeferredTLUT.
+	void SetTLUT(const uint8_t* tlut, TlutFormat fmt);
+	// Decode the indices to an r32ui image only when the encoded data changes and apply
+	// the TLUT in a second pass, instead of decoding everything every time.
+	bool SetDeferredTLUT(bool enable);
+	bool IsDeferredTLUT() const { return m_deferred_tlut; }
+
+	// Decode to GetNarrowFormat() instead of RGBA8, through buffer output into a normalized texture
+	// swizzled to read back as RGBA. Fails, leaving RGBA8 in place, for formats without a narrow one
+	// and for mip chains.
+	bool SetNarrowOutput(bool enable);
+	DecodedFormat GetDecodedFormat() const { return m_decoded_format; }
+
+	// Times every DecoderVariant on this device and keeps the fastest for this format and
+	// size class, so later TextureConverts of the same kind start out with it
+	void Autotune(int iterations = 8);
+	// Autotune every format and size class the first time one is created
+	static void SetAutotune(bool enable);
+	const DecoderVariant& GetVariant() const { return m_variant; }
+
+	// AUTO times both modes on the first TextureConvert and uses the faster from then on
+	void SetOutputMode(OutputMode mode);
+	OutputMode GetOutputMode() const { return m_output; }
+	// What SetOutputMode picks for every new TextureConvert
+	static void SetDefaultOutputMode(OutputMode mode);
+
+	// Decode a mip chain of this many levels, 0 for every level down to 1x1 and 1 for just the base.
+	// The encoded data grows to GetMipChainEncodedSize and the chain is decoded in one dispatch to
+	// buffer output, with no BC1 transcode or deferred TLUT. Returns the levels it went with.
+	int SetMipLevels(int levels);
+	int GetMipLevels() const { return m_levels; }
+
+	// DecodeImage only decodes when the cache has nothing for the encoded data and TLUT,
+	// and decodes into the cache's texture then. Null decodes every time into our own.
+	void SetTextureCache(TextureCache* cache);
+
+	// DecodeImage only decodes on the backend the scheduler picks, timing it to refine the model,
+	// and calibrates the scheduler for this format first if nothing did yet. Not for BC1 transcodes,
+	// deferred TLUTs, mip chains or dirty tiles, those still run everything. Null runs everything.
+	void SetScheduler(DecodeScheduler* scheduler);
+
+	// DecodeImage has the GPU decode the top block rows while the CPU threads decode the rest into
+	// a mapped unpack buffer, uploaded into the same texture. The share of each side follows how
+	// fast each was on the last frames, so both finish about together. Same limits as SetScheduler.
+	void SetSplitDecode(bool enable);
+
+	// Where every new TextureConvert gets its textures and buffers, and gives them back to when it's
+	// deleted. Null, the default, creates and deletes them every time.
+	static void SetTexturePool(TexturePool* pool);
+
+	// DecodeImage records the encoded data and TLUT of every decode, null stops that
+	void SetTraceWriter(TraceWriter* trace) { m_trace = trace; }
 
 	GLuint GetEncImg() const { return enc_img; }
-	GLuint GetDecImg() const { return dec_img; }
+	// BC1 transcodes and narrow output are sampled, everything else is read as an rgba8ui image
+	GLuint GetDecImg() const { return m_target; }
+	bool IsSampled() const { return m_bc1 || m_decoded_format != DecodedFormat::RGBA8; }
 
 private:
+	void TranscodeOnGPU(const std::vector<TexRect>& rects);
+	// Only decodes indices in rects when partial, unless they are all stale
+	void ApplyTLUTOnGPU(const std::vector<TexRect>& rects, bool partial);
+	void DecodeRectsOnGPU(const std::vector<TexRect>& rects, bool partial);
+	void DecodeMipChainOnGPU();
+	void DecodeScheduled();
+	void DecodeSplit();
+	bool IsBufferOutput() const { return m_output == OutputMode::BUFFER || m_decoded_format != DecodedFormat::RGBA8; }
+	// The texture decodes go to without a cache: dec_img, bc1_img, narrow_img or mip_img
+	GLuint GetOwnTarget() const;
+	// Transcode and TLUT passes only have some kernels, and no threaded version
+	bool HasCPUPass(CPUKernel kernel) const;
+	// The decode uniforms and dispatch for m_variant, over the tiles of rect
+	void SetDecodeUniforms(GLuint pgm);
+	void Dispatch(GLuint pgm, const TexRect& rect);
+	// Buffer and narrow output only, from dec_buf into m_target
+	void CopyOutput(const std::vector<TexRect>& rects);
+	// Points m_target at the cached texture for the current data, true on a hit
+	bool LookupCache();
+	OutputMode MeasureOutputMode();
+	// Points enc_img at the current upload, in the format m_variant fetches with
+	void BindEncodedBuffer();
+	// Replaces dec_buf with one of size bytes if it's smaller
+	void ReserveDecodeBuffer(size_t size);
 
-	void GenRGB565();
+	void GenData();
+	void UploadData();
+	// Just the m_dirty tiles, once enc_buf holds the rest
+	void UploadDirty();
+	// Grows rect out to whole tiles
+	void MarkDirty(int x, int y, int w, int h);
+	void GenDirtyTiles();
+	void GenTLUT();
 
+	TexturePool* m_pool;
 	GLuint enc_img, dec_img;
+	// What the GPU decode writes: dec_img, bc1_img or a TextureCache texture
+	GLuint m_target;
+	TextureCache* m_cache = nullptr;
+	// us spent hashing the encoded data for the cache
+	uint64_t totaltime_hash = 0, hash_bytes = 0;
+	DecodeScheduler* m_scheduler = nullptr;
+	// us each timed GPU decode took to submit, until the GPU time of it comes in
+	std::deque<uint64_t> m_gpu_submits;
+	// Split decode: the GPU takes m_split of the block rows, the CPU the rest
+	bool m_split_decode = false;
+	double m_split = 0.5;
+	// Block rows per us each side managed, smoothed
+	double m_gpu_rows_per_us = 0, m_cpu_rows_per_us = 0;
+	// GPU rows of every timed frame whose result hasn't come in yet
+	std::deque<int> m_split_rows;
+	GLuint split_buf = 0;
+	TraceWriter* m_trace = nullptr;
+	// DecodeImage decodes data as it is, rather than generating it
+	bool m_given_data = false;
+	// ns of GPU time and us of CPU time
+	uint64_t totaltime_split_gpu = 0, num_split_gpu = 0, totaltime_split_cpu = 0, num_split_cpu = 0;
 	GLuint enc_buf;
+	// enc_buf holds all of data, rather than a ring segment
+	bool m_resident = false;
+	// m_target holds a full decode of what is in enc_buf
+	bool m_decoded = false;
+	std::vector<TexRect> m_dirty;
+	int m_dirty_tiles = 0;
+	uint32_t m_dirty_seed = 1;
+	// Tiles decoded by DecodeDirtyOnGPU, out of all the tiles it could have
+	uint64_t decoded_tiles = 0, total_tiles = 0;
+	// Persistently mapped encoded data, when the driver has buffer storage
+	std::unique_ptr<StreamBuffer> m_stream;
 	TexType m_type;
 	int m_w, m_h;
+	DecoderVariant m_variant;
+	OutputMode m_output = OutputMode::IMAGE;
+	GLuint dec_buf = 0;
+	size_t dec_buf_size = 0;
+	int m_levels = 1;
+	GLuint mip_img = 0, table_buf = 0;
 	std::vector<uint8_t> data;
 	std::vector<uint32_t> cpudata;
+
+	// CMPR -> BC1
+	bool m_bc1 = false;
+	GLuint bc1_img = 0, bc1_buf = 0;
+	std::vector<uint8_t> bc1data;
+
+	// I4, I8, IA4, IA8 and RGB565
+	DecodedFormat m_decoded_format = DecodedFormat::RGBA8;
+	GLuint narrow_img = 0;
+
+	// Paletted formats
+	TlutFormat m_tlut_fmt = TlutFormat::RGB565;
+	GLuint tlut_img = 0, tlut_buf = 0, idx_img = 0;
+	bool m_deferred_tlut = false;
+	bool m_indices_dirty = true, m_cpu_indices_dirty = true;
+	// Texels outside the decoded rects still have the previous TLUT applied
+	bool m_tlut_dirty = true;
+	std::vector<uint8_t> tlutdata;
+	std::vector<uint16_t> cpuindices;
+
 	uint32_t m_shift_val = 1;
 	GPUTimer m_timer;
 	CPUTimer m_cputime;
@@ -32,5 +244,67 @@ private:
 
 	// Average time spent in shader
 	CPUTimer m_avgtime;
-	uint64_t totaltime_gpu = 0, totaltime_cpu = 0, totaltime_cpusse = 0, num_times = 0;
+	uint64_t totaltime_gpu = 0, num_times = 0;
+	// GPU results arrive a few frames late and some frames aren't timed at all
+	uint64_t num_gpu_times = 0, dropped_gpu_times = 0;
+	struct StageTime { uint64_t total = 0, count = 0; };
+	std::map<std::string, StageTime> stage_times;
+	// us spent uploading, including waits for the ring
+	uint64_t totaltime_upload = 0, upload_bytes = 0;
+	// Per CPUKernel, single threaded and band-parallel
+	std::array<uint64_t, (size_t)CPUKernel::COUNT> totaltime_cpu{}, totaltime_cpu_mt{};
+};
+
+// One texture of a BatchConvert, src is GetEncodedSize(type, width, height) bytes
+struct DecodeJob
+{
+	const uint8_t* src;
+	int width, height;
+};
+
+// Decodes many small textures of one format with one upload and one dispatch, into the layers
+// of an rgba8ui 2D array texture. Each texture costs its tiles, not a bind and dispatch of its own.
+class BatchConvert
+{
+public:
+	BatchConvert(TexType type);
+	~BatchConvert();
+
+	// Paletted formats only, one TLUT for the whole batch
+	void SetTLUT(const uint8_t* tlut, TlutFormat fmt);
+
+	// Layer i gets jobs[i] in its 0,0 corner. The array grows to the largest texture and the
+	// longest batch seen so far.
+	void Decode(const std::vector<DecodeJob>& jobs);
+	GLuint GetArrayImg() const { return array_img; }
+
+	// Generates count textures from 32x32 to 128x128 once, then decodes them batched and one at a
+	// time, on the GPU and the best CPU kernel, and prints timings every second
+	void DecodeImages(int count);
+
+private:
+	void GenJobs(int count);
+
+	TexType m_type;
+	GLuint enc_img, enc_buf, table_buf;
+	GLuint array_img = 0;
+	int m_array_w = 0, m_array_h = 0, m_layers = 0;
+	std::vector<GLuint> m_table;
+	Sampler mSampler;
+
+	TlutFormat m_tlut_fmt = TlutFormat::RGB565;
+	GLuint tlut_img = 0, tlut_buf = 0;
+	std::vector<uint8_t> tlutdata;
+
+	// DecodeImages
+	std::vector<std::vector<uint8_t>> m_srcs;
+	std::vector<DecodeJob> m_jobs;
+	std::vector<CPUDecodeJob> m_cpu_jobs;
+	std::vector<uint32_t> cpudata;
+	GPUTimer m_timer;
+	CPUTimer m_avgtime;
+	uint64_t num_times = 0, num_gpu_times = 0;
+	// ns of GPU time and us spent submitting, batched and one at a time
+	uint64_t totaltime_gpu = 0, totaltime_gpu_single = 0, totaltime_submit = 0, totaltime_submit_single = 0;
+	uint64_t totaltime_cpu = 0, totaltime_cpu_single = 0;
 };
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <ctime>
 #include <stdio.h>
 #include <string.h>
@@ -8,34 +9,104 @@
 
 #include <epoxy/gl.h>
 
+// GL_TIMESTAMP marks kept in a ring of frames. Results are picked up a few frames
+// later, once GL_QUERY_RESULT_AVAILABLE says so, so timing never waits on the GPU.
+// A frame that would reuse queries still in flight just isn't measured.
 class GPUTimer
 {
 public:
-	GPUTimer()
+	static const int MAX_STAGES = 8;
+
+	struct Result
+	{
+		uint64_t total;
+		int num_stages;
+		// ns per stage, in the order they were marked
+		std::array<uint64_t, MAX_STAGES> stages;
+		std::array<const char*, MAX_STAGES> names;
+	};
+
+	explicit GPUTimer(int frames = 4)
+		: m_frames(frames)
 	{
-		glGenQueries(1, &m_query);
+		for (Frame& frame : m_frames)
+			glGenQueries(MAX_STAGES + 1, frame.queries);
 	}
 	~GPUTimer()
 	{
-		glDeleteQueries(1, &m_query);
+		for (Frame& frame : m_frames)
+			glDeleteQueries(MAX_STAGES + 1, frame.queries);
 	}
 
-	void BeginTimer()
+	// False when this frame isn't timed, and won't have a result
+	bool BeginTimer()
 	{
-		glBeginQuery(GL_TIME_ELAPSED, m_query);
+		Frame& frame = m_frames[m_next];
+		if (frame.pending)
+		{
+			m_current = nullptr;
+			m_dropped++;
+			return false;
+		}
+
+		m_current = &frame;
+		m_next = (m_next + 1) % m_frames.size();
+		frame.marks = 0;
+		glQueryCounter(frame.queries[frame.marks++], GL_TIMESTAMP);
+		return true;
 	}
 
-	void EndTimer()
+	// Ends the stage running since the last mark. A no-op outside Begin/EndTimer.
+	void Mark(const char* stage)
 	{
-		glEndQuery(GL_TIME_ELAPSED);
+		if (!m_current || m_current->marks > MAX_STAGES)
+			return;
+
+		m_current->names[m_current->marks - 1] = stage;
+		glQueryCounter(m_current->queries[m_current->marks++], GL_TIMESTAMP);
 	}
 
-	uint64_t GetTime()
+	void EndTimer(const char* stage = "")
 	{
-		uint64_t res = 0;
-		glGetQueryObjectui64v(m_query, GL_QUERY_RESULT, &res);
-		return res;
+		Mark(stage);
+		if (m_current)
+			m_current->pending = true;
+		m_current = nullptr;
 	}
+
+	// Oldest finished frame, false if there's nothing ready yet
+	bool GetResult(Result* result)
+	{
+		Frame& frame = m_frames[m_read];
+		if (!frame.pending)
+			return false;
+
+		// Marks complete in order, so the last one covers the others
+		GLuint available = 0;
+		glGetQueryObjectuiv(frame.queries[frame.marks - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			return false;
+
+		std::array<uint64_t, MAX_STAGES + 1> times;
+		for (int i = 0; i < frame.marks; ++i)
+			glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &times[i]);
+
+		result->num_stages = frame.marks - 1;
+		result->total = times[frame.marks - 1] - times[0];
+		for (int i = 0; i < result->num_stages; ++i)
+		{
+			result->stages[i] = times[i + 1] - times[i];
+			result->names[i] = frame.names[i];
+		}
+
+		frame.pending = false;
+		m_read = (m_read + 1) % m_frames.size();
+		return true;
+	}
+
+	// Frames skipped because every query was still in flight
+	uint64_t GetDropped() const { return m_dropped; }
+
 	static int64_t GetTimestamp()
 	{
 		int64_t res = 0;
@@ -44,7 +115,18 @@ public:
 	}
 
 private:
-	GLuint m_query;
+	struct Frame
+	{
+		GLuint queries[MAX_STAGES + 1];
+		const char* names[MAX_STAGES];
+		int marks = 0;
+		bool pending = false;
+	};
+
+	std::vector<Frame> m_frames;
+	Frame* m_current = nullptr;
+	size_t m_next = 0, m_read = 0;
+	uint64_t m_dropped = 0;
 };
 
 class CPUTimer
@@ -0,0 +1,89 @@
+#include <string.h>
+
+#include "Hash.h"
+
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t PRIME3 = 0x165667B19E3779F9ull;
+static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ull;
+static const uint64_t PRIME5 = 0x27D4EB2F165667C5ull;
+
+static inline uint64_t Rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t Read64(const uint8_t* p)
+{
+	uint64_t val;
+	memcpy(&val, p, sizeof(val));
+	return val;
+}
+
+static inline uint32_t Read32(const uint8_t* p)
+{
+	uint32_t val;
+	memcpy(&val, p, sizeof(val));
+	return val;
+}
+
+static inline uint64_t Round(uint64_t acc, uint64_t input)
+{
+	acc += input * PRIME2;
+	return Rotl(acc, 31) * PRIME1;
+}
+
+static inline uint64_t MergeRound(uint64_t acc, uint64_t val)
+{
+	acc ^= Round(0, val);
+	return acc * PRIME1 + PRIME4;
+}
+
+uint64_t XXH64(const void* data, size_t size, uint64_t seed)
+{
+	const uint8_t* p = (const uint8_t*)data;
+	const uint8_t* const end = p + size;
+	uint64_t hash;
+
+	// Four independent lanes over 32 byte stripes
+	if (size >= 32)
+	{
+		uint64_t v1 = seed + PRIME1 + PRIME2;
+		uint64_t v2 = seed + PRIME2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - PRIME1;
+		for (; p + 32 <= end; p += 32)
+		{
+			v1 = Round(v1, Read64(p));
+			v2 = Round(v2, Read64(p + 8));
+			v3 = Round(v3, Read64(p + 16));
+			v4 = Round(v4, Read64(p + 24));
+		}
+		hash = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+		hash = MergeRound(hash, v1);
+		hash = MergeRound(hash, v2);
+		hash = MergeRound(hash, v3);
+		hash = MergeRound(hash, v4);
+	}
+	else
+		hash = seed + PRIME5;
+
+	hash += size;
+
+	for (; p + 8 <= end; p += 8)
+		hash = Rotl(hash ^ Round(0, Read64(p)), 27) * PRIME1 + PRIME4;
+	if (p + 4 <= end)
+	{
+		hash = Rotl(hash ^ (Read32(p) * PRIME1), 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+	for (; p < end; ++p)
+		hash = Rotl(hash ^ (*p * PRIME5), 11) * PRIME1;
+
+	hash ^= hash >> 33;
+	hash *= PRIME2;
+	hash ^= hash >> 29;
+	hash *= PRIME3;
+	hash ^= hash >> 32;
+	return hash;
+}
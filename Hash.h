@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// XXH64, bit for bit the reference one, so hashes can be checked against other tools
+uint64_t XXH64(const void* data, size_t size, uint64_t seed = 0);
@@ -1,21 +1,107 @@
 #include <array>
+#include <chrono>
 #include <map>
 #include <memory>
+#include <string.h>
+#include <strings.h>
+#include <thread>
+#include <tuple>
 #include <vector>
 
 #include <epoxy/gl.h>
 
+#include "Benchmark.h"
 #include "Context.h"
 #include "CPUDecoder.h"
 #include "GLUtils.h"
 #include "GPUDecoder.h"
 #include "GPUTimer.h"
+#include "ProgramCache.h"
+#include "Trace.h"
 
 TextureConvert* conv;
+static std::unique_ptr<TexturePool> s_texture_pool;
 
-void DrawTriangle(uint32_t TexDim)
+// What the DECODE_* variables ask of every TextureConvert
+struct DecodeSettings
 {
-	conv = new TextureConvert(TexType::TYPE_RGB565, TexDim, TexDim);
+	std::unique_ptr<DecodeScheduler> scheduler;
+	bool split = false;
+	bool narrow = false;
+	std::unique_ptr<TextureCache> cache;
+	bool mipmaps = false;
+	int dirty_tiles = 0;
+};
+
+static void ReadDecodeSettings(DecodeSettings* settings)
+{
+	// DECODE_SCHEDULE=1 decodes on one backend a frame, picked by a cost model, instead of all of them
+	const char* schedule = getenv("DECODE_SCHEDULE");
+	if (schedule && atoi(schedule))
+		settings->scheduler.reset(new DecodeScheduler(true));
+	// DECODE_SPLIT=1 decodes part of the texture on the GPU and the rest on the CPU threads at once
+	const char* split = getenv("DECODE_SPLIT");
+	settings->split = split && atoi(split);
+	// DECODE_NARROW=1 decodes to R8, RG8 or RGB565 where the format fits in one
+	const char* narrow = getenv("DECODE_NARROW");
+	settings->narrow = narrow && atoi(narrow);
+	// DECODE_TEXTURE_CACHE=<MB> only decodes data that isn't already cached
+	const char* cache_mb = getenv("DECODE_TEXTURE_CACHE");
+	if (cache_mb && atoi(cache_mb) > 0)
+		settings->cache.reset(new TextureCache((size_t)atoi(cache_mb) * 1024 * 1024));
+	// DECODE_MIPMAPS=1 decodes the whole mip chain, the base level is what gets drawn
+	const char* mipmaps = getenv("DECODE_MIPMAPS");
+	settings->mipmaps = mipmaps && atoi(mipmaps);
+	// DECODE_DIRTY_TILES=<N> rewrites N tiles a frame and decodes only those
+	const char* dirty_tiles = getenv("DECODE_DIRTY_TILES");
+	settings->dirty_tiles = dirty_tiles ? std::max(atoi(dirty_tiles), 0) : 0;
+}
+
+static void ApplyDecodeSettings(const DecodeSettings& settings, TextureConvert* conv, TexType type)
+{
+	if (settings.scheduler)
+		conv->SetScheduler(settings.scheduler.get());
+	else if (settings.split)
+		conv->SetSplitDecode(true);
+	// Neither does BC1 transcodes, deferred TLUTs or narrow output
+	else
+	{
+		if (type == TexType::TYPE_CMPR)
+			printf("CMPR output: %s\n", conv->SetBC1Transcode(true) ? "BC1 transcode" : "RGBA8 decode");
+		if (IsPaletted(type))
+			printf("TLUT: %s\n", conv->SetDeferredTLUT(true) ? "deferred" : "decoded with the texture");
+		if (settings.narrow && conv->SetNarrowOutput(true))
+			printf("Output: %s\n", GetDecodedFormatName(conv->GetDecodedFormat()));
+	}
+
+	if (settings.cache)
+		conv->SetTextureCache(settings.cache.get());
+	if (settings.mipmaps)
+		printf("Mip levels: %d\n", conv->SetMipLevels(0));
+	if (settings.dirty_tiles)
+		conv->SetDirtyTilesPerFrame(settings.dirty_tiles);
+}
+
+void DrawTriangle(TexType type, uint32_t TexDim)
+{
+	conv = new TextureConvert(type, TexDim, TexDim);
+	DecodeSettings settings;
+	ReadDecodeSettings(&settings);
+	ApplyDecodeSettings(settings, conv, type);
+
+	// DECODE_BATCH=<N> also decodes N small textures of the same format a frame, batched and not
+	std::unique_ptr<BatchConvert> batch;
+	const char* batch_count = getenv("DECODE_BATCH");
+	if (batch_count && atoi(batch_count) > 0)
+		batch.reset(new BatchConvert(type));
+	// DECODE_TRACE=<file> records every decode of the texture for --replay
+	TraceWriter trace;
+	const char* trace_path = getenv("DECODE_TRACE");
+	if (trace_path && trace.Open(trace_path))
+		conv->SetTraceWriter(&trace);
+	// DECODE_TRACE_FRAMES=<N> stops after N frames, otherwise this runs until it's killed
+	const char* trace_frames = getenv("DECODE_TRACE_FRAMES");
+	const int max_frames = trace_frames ? std::max(atoi(trace_frames), 0) : 0;
 
 	const char* fs_test =
 	"#version 310 es\n"
@@ -25,12 +111,17 @@ void DrawTriangle(uint32_t TexDim)
 	"in vec4 vert;\n"
 	"layout(rgba8ui, binding = 1) readonly uniform uimage2D image;\n"
 	"layout(binding = 0) uniform sampler2D tex;\n"
+	"uniform bool sample_tex;\n"
 
 	"out vec4 ocol;\n"
 	"void main() {\n"
 		"\tvec2 fcoords = vec2(0.0);\n"
 		"\tfcoords = (gl_FragCoord.xy);\n"
 		"\tivec2 coords = ivec2(fcoords);\n"
+		"\tif (sample_tex) {\n"
+			"\t\tocol = texelFetch(tex, coords, 0);\n"
+			"\t\treturn;\n"
+		"\t}\n"
 		"\tuvec4 ucol = imageLoad(image, coords);\n"
 		"\tvec4 out_col = vec4(ucol);\n"
 		"\tocol = vec4(out_col) / 255.0;\n"
@@ -69,6 +160,7 @@ void DrawTriangle(uint32_t TexDim)
 	GLUtils::CheckProgramLinkStatus(pgm);
 
 	glUseProgram(pgm);
+	glUniform1i(glGetUniformLocation(pgm, "sample_tex"), conv->IsSampled());
 
 	// Get attribute locations
 	attr_pos = glGetAttribLocation(pgm, "pos");
@@ -92,33 +184,41 @@ void DrawTriangle(uint32_t TexDim)
 
 	conv->DecodeImage();
 
-	std::clock_t begin, start, end;
+	// Wall time, std::clock only counts our own CPU time
+	auto begin = std::chrono::steady_clock::now();
 	int iters = 0;
-	begin = std::clock();
-	for (;;)
+	for (int frame = 0; !max_frames || frame < max_frames; ++frame)
 	{
 		conv->DecodeImage();
+		if (batch)
+			batch->DecodeImages(atoi(batch_count));
 		glUseProgram(pgm);
 
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		glVertexAttribPointer(attr_pos, 2, GL_FLOAT, GL_FALSE, 0, verts);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, conv->GetDecImg());
+		// The decode target changes with the texture cache
+		if (conv->IsSampled())
+		{
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, conv->GetDecImg());
+		}
+		else
+			glBindImageTexture(1, conv->GetDecImg(), 0, false, 0, GL_READ_ONLY, GL_RGBA8UI);
 
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 		Context::Swap();
-		end = std::clock();
+		trace.EndFrame();
 		iters++;
-		double duration = (end - begin) / (double)CLOCKS_PER_SEC;
-		if (duration >= 1.0)
+		auto end = std::chrono::steady_clock::now();
+		if (end - begin >= std::chrono::seconds(1))
 		{
 			printf("iterated: %d\n", iters);
 			iters = 0;
-			begin = std::clock();
+			begin = end;
 		}
-
 	}
+	conv->SetTraceWriter(nullptr);
 }
 
 static void APIENTRY ErrorCallback( GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const char* message, const void* userParam)
@@ -128,16 +228,47 @@ static void APIENTRY ErrorCallback( GLenum source, GLenum type, GLuint id, GLenu
 		__builtin_trap();
 }
 
-int main(int argc, char** argv)
+// Before the context goes, with every TextureConvert deleted
+static void ShutdownTexturePool()
+{
+	if (!s_texture_pool)
+		return;
+
+	const TexturePool::Stats& stats = s_texture_pool->GetStats();
+	printf("Texture pool: %ld GL objects created, %ld reused, %ld trimmed, %d pooled in %.1f/%.1fMB\n",
+		stats.allocations, stats.reuses, stats.trims, stats.entries,
+		stats.pooled / (1024.0 * 1024.0), stats.budget / (1024.0 * 1024.0));
+	TextureConvert::SetTexturePool(nullptr);
+	s_texture_pool.reset();
+}
+
+static void PrintUsage(const char* name)
+{
+	printf("Usage: [DECODE_PLATFORM=glx|surfaceless|gbm] [DECODE_AUTOTUNE=1] [DECODE_OUTPUT=image|buffer]\n"
+	       "       [DECODE_SHADER_CACHE=dir|0] [DECODE_DUMP_SHADERS=1] [DECODE_TEXTURE_CACHE=MB]\n"
+	       "       [DECODE_DIRTY_TILES=N] [DECODE_MIPMAPS=1] [DECODE_BATCH=N]\n"
+	       "       [DECODE_SCHEDULE=1] [DECODE_SPLIT=1] [DECODE_TRACE=file] [DECODE_TRACE_FRAMES=N]\n"
+	       "       [DECODE_NARROW=1] [DECODE_TEXTURE_POOL=MB]\n"
+	       "       %s <tex dim> [decode threads] [format]\n"
+	       "       %s --bench [benchmark options]\n"
+	       "       %s --replay <trace> [--paced] [--loops=N]\nFormats:", name, name, name);
+	for (int i = 0; i < (int)TexType::TYPE_COUNT; ++i)
+		printf(" %s", GetTexInfo((TexType)i).name);
+	printf("\n");
+	Benchmark::PrintUsage();
+}
+
+static bool CreateContext()
 {
-	if (argc != 2)
-	{
-		printf("Usage: %s <tex dim>\n", argv[0]);
-		return 0 ;
-	}
-	uint32_t TexDim = atoi(argv[1]);
 	GLint x,y,z;
-	Context::Create();
+
+	// DECODE_PLATFORM=glx|surfaceless|gbm, otherwise headless whenever there's no X display
+	Context::Platform platform = Context::Platform::AUTO;
+	const char* platform_name = getenv("DECODE_PLATFORM");
+	if (platform_name && !Context::GetPlatformFromName(platform_name, &platform))
+		printf("Unknown DECODE_PLATFORM '%s', picking one\n", platform_name);
+	if (!Context::Create(platform))
+		return false;
 
 	printf("Are we in desktop GL? %s\n", epoxy_is_desktop_gl() ? "Yes" : "No");
 	printf("Our GL version %d\n", epoxy_gl_version());
@@ -165,8 +296,204 @@ int main(int argc, char** argv)
 	glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, true);
 	glDebugMessageCallback(ErrorCallback, nullptr);
 	glEnable(GL_DEBUG_OUTPUT);
+	return true;
+}
+
+static int RunBenchmark(int argc, char** argv)
+{
+	Benchmark::Options opts;
+	for (int i = 2; i < argc; ++i)
+		if (!Benchmark::ParseOption(argv[i], &opts))
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+
+	std::vector<Benchmark::Backend> backends = Benchmark::GetCPUBackends();
+
+	// Only bring GL up when a GPU backend is wanted
+	bool want_gpu = opts.backends.empty();
+	for (const std::string& name : opts.backends)
+		want_gpu |= !strncasecmp(name.c_str(), "GPU", 3);
+
+	std::unique_ptr<TextureConvert> gpu_conv;
+	const bool have_gl = want_gpu && CreateContext();
+	if (have_gl)
+	{
+		opts.host_info.emplace_back("gl_renderer", (const char*)glGetString(GL_RENDERER));
+		opts.host_info.emplace_back("gl_version", (const char*)glGetString(GL_VERSION));
+
+		// Dispatch to completion, so it's timed the same way as the CPU backends.
+		// "GPU" is whichever output mode the device picked, the others force one.
+		const std::pair<const char*, OutputMode> gpu_backends[] = {
+			{ "GPU", OutputMode::AUTO }, { "GPU-image", OutputMode::IMAGE }, { "GPU-buffer", OutputMode::BUFFER },
+		};
+		for (const auto& gpu_backend : gpu_backends)
+		{
+			const OutputMode output = gpu_backend.second;
+			Benchmark::Backend gpu;
+			gpu.name = gpu_backend.first;
+			gpu.prepare = [&gpu_conv, output](const Benchmark::Input& in)
+			{
+				gpu_conv.reset();
+				gpu_conv.reset(new TextureConvert(in.type, in.width, in.height));
+				gpu_conv->SetOutputMode(output);
+				gpu_conv->SetEncodedData(in.src);
+				if (IsPaletted(in.type))
+					gpu_conv->SetTLUT(in.tlut, in.tlut_fmt);
+			};
+			gpu.run = [&gpu_conv](const Benchmark::Input&)
+			{
+				gpu_conv->DecodeOnGPU();
+				glFinish();
+			};
+			backends.push_back(gpu);
+		}
+	}
+	else if (want_gpu)
+		printf("No GL context, only running the CPU backends\n");
+
+	const bool ok = Benchmark::Run(opts, backends);
+	if (have_gl)
+		ProgramCache::PrintStats();
+
+	gpu_conv.reset();
+	if (have_gl)
+	{
+		ShutdownTexturePool();
+		Context::Shutdown();
+	}
+	return ok ? 0 : 1;
+}
+
+// Decodes every texture of a DECODE_TRACE capture with the DECODE_* settings, through a TextureConvert
+// per format and size, as fast as it goes or, with --paced, no sooner than it was captured
+static int RunReplay(int argc, char** argv)
+{
+	bool paced = false;
+	int loops = 1;
+	bool ok = argc >= 3;
+	for (int i = 3; i < argc && ok; ++i)
+	{
+		if (!strcmp(argv[i], "--paced"))
+			paced = true;
+		else if (!strncmp(argv[i], "--loops=", 8) && atoi(argv[i] + 8) > 0)
+			loops = atoi(argv[i] + 8);
+		else
+			ok = false;
+	}
+	if (!ok)
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	TraceReader trace;
+	if (!trace.Open(argv[2]))
+		return 1;
+	SetDecodeThreadCount(0);
+	if (!CreateContext())
+		return 1;
+
+	DecodeSettings settings;
+	ReadDecodeSettings(&settings);
+	std::map<std::tuple<TexType, int, int, int>, std::unique_ptr<TextureConvert>> convs;
+	uint64_t frames = 0, textures = 0, bytes = 0;
+	const auto begin = std::chrono::steady_clock::now();
+	for (int loop = 0; loop < loops; ++loop)
+	{
+		// Late frames don't sleep, so the replay catches up with the capture
+		const auto start = std::chrono::steady_clock::now();
+		TraceReader::Event event;
+		trace.Rewind();
+		while (trace.Next(&event))
+		{
+			if (event.kind == TraceReader::Event::Kind::FRAME)
+			{
+				if (paced)
+					std::this_thread::sleep_until(start + std::chrono::microseconds(event.time));
+				frames++;
+				continue;
+			}
+
+			std::unique_ptr<TextureConvert>& texture = convs[std::make_tuple(event.type, event.width, event.height, event.levels)];
+			if (!texture)
+			{
+				texture.reset(new TextureConvert(event.type, event.width, event.height));
+				ApplyDecodeSettings(settings, texture.get(), event.type);
+				texture->SetMipLevels(event.levels);
+			}
+			if (event.tlut)
+				texture->SetTLUT(event.tlut, event.tlut_fmt);
+			texture->DecodeImage(event.data);
+			textures++;
+			bytes += GetMipChainEncodedSize(event.type, event.width, event.height, event.levels);
+		}
+	}
+	glFinish();
+
+	const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+	printf("Replayed %ld frames, %ld textures of %zu formats and sizes, %.1fMB in %.0fms: %.0f frames/s, %.0f textures/s, %.1fMB/s\n",
+		frames, textures, convs.size(), bytes / (1024.0 * 1024.0), ms,
+		frames * 1000.0 / ms, textures * 1000.0 / ms, bytes / (1024.0 * 1024.0) * 1000.0 / ms);
+
+	convs.clear();
+	ShutdownTexturePool();
+	Context::Shutdown();
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	// Time every shader variant the first time a format and size class is decoded
+	const char* autotune = getenv("DECODE_AUTOTUNE");
+	TextureConvert::SetAutotune(autotune && strcmp(autotune, "0"));
+
+	// Otherwise whichever of the two is faster on this device
+	const char* output = getenv("DECODE_OUTPUT");
+	if (output && !strcasecmp(output, "image"))
+		TextureConvert::SetDefaultOutputMode(OutputMode::IMAGE);
+	else if (output && !strcasecmp(output, "buffer"))
+		TextureConvert::SetDefaultOutputMode(OutputMode::BUFFER);
+	else if (output)
+		printf("Unknown DECODE_OUTPUT '%s', picking one\n", output);
+
+	// DECODE_TEXTURE_POOL=<MB> hands the textures and buffers of deleted TextureConverts to new ones
+	const char* pool_mb = getenv("DECODE_TEXTURE_POOL");
+	if (pool_mb && atoi(pool_mb) > 0)
+	{
+		s_texture_pool.reset(new TexturePool((size_t)atoi(pool_mb) * 1024 * 1024));
+		TextureConvert::SetTexturePool(s_texture_pool.get());
+	}
+
+	// Program binaries go to ~/.cache unless told otherwise, 0 always compiles from source
+	const char* shader_cache = getenv("DECODE_SHADER_CACHE");
+	if (!shader_cache)
+		ProgramCache::SetDirectory(ProgramCache::GetDefaultDirectory());
+	else if (strcmp(shader_cache, "0"))
+		ProgramCache::SetDirectory(shader_cache);
+
+	const char* dump_shaders = getenv("DECODE_DUMP_SHADERS");
+	GLUtils::SetDumpShaders(dump_shaders && strcmp(dump_shaders, "0"));
+
+	if (argc >= 2 && !strcmp(argv[1], "--bench"))
+		return RunBenchmark(argc, argv);
+	if (argc >= 2 && !strcmp(argv[1], "--replay"))
+		return RunReplay(argc, argv);
+
+	TexType type = TexType::TYPE_RGB565;
+	if (argc < 2 || argc > 4 || (argc == 4 && !GetTexTypeFromName(argv[3], &type)))
+	{
+		PrintUsage(argv[0]);
+		return 0 ;
+	}
+	uint32_t TexDim = atoi(argv[1]);
+	SetDecodeThreadCount(argc >= 3 ? atoi(argv[2]) : 0);
+
+	if (!CreateContext())
+		return 1;
 
-	DrawTriangle(TexDim);
+	DrawTriangle(type, TexDim);
 
 	Context::Shutdown();
 }
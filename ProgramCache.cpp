@@ -0,0 +1,208 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "GLUtils.h"
+#include "Hash.h"
+#include "ProgramCache.h"
+
+namespace ProgramCache
+{
+	static const uint32_t FILE_MAGIC = 0x42504347; // "GCPB"
+
+	static std::string s_dir;
+	static bool s_init = false;
+	static bool s_binaries = false;
+	// Renderer and version, part of every key
+	static std::string s_device;
+	static uint64_t s_loaded = 0, s_compiled = 0, s_rejected = 0;
+
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t format;
+		uint32_t key_size;
+		uint32_t binary_size;
+	};
+
+	void SetDirectory(const std::string& dir)
+	{
+		s_dir = dir;
+	}
+
+	std::string GetDefaultDirectory()
+	{
+		const char* xdg = getenv("XDG_CACHE_HOME");
+		if (xdg && *xdg)
+			return std::string(xdg) + "/gc-decode";
+		const char* home = getenv("HOME");
+		if (home && *home)
+			return std::string(home) + "/.cache/gc-decode";
+		return "";
+	}
+
+	static bool MakeDirectories(const std::string& dir)
+	{
+		for (size_t i = 1; i <= dir.size(); ++i)
+		{
+			if (i < dir.size() && dir[i] != '/')
+				continue;
+			if (mkdir(dir.substr(0, i).c_str(), 0755) && errno != EEXIST)
+				return false;
+		}
+		return true;
+	}
+
+	static void Init()
+	{
+		if (s_init)
+			return;
+		s_init = true;
+
+		if (epoxy_has_gl_extension("GL_KHR_parallel_shader_compile"))
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		if (s_dir.empty() || !formats)
+			return;
+		if (!MakeDirectories(s_dir))
+		{
+			printf("Couldn't create the shader cache in %s, compiling from source\n", s_dir.c_str());
+			return;
+		}
+
+		s_device = std::string((const char*)glGetString(GL_RENDERER)) + "\n" + (const char*)glGetString(GL_VERSION) + "\n";
+		s_binaries = true;
+		printf("Shader cache: %s\n", s_dir.c_str());
+	}
+
+	static std::string GetPath(const std::string& key)
+	{
+		char name[32];
+		// The hash only names the file, the whole key is stored and compared on load
+		snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)XXH64(key.data(), key.size()));
+		return s_dir + name;
+	}
+
+	static GLuint LoadBinary(const std::string& key)
+	{
+		const std::string path = GetPath(key);
+		FILE* file = fopen(path.c_str(), "rb");
+		if (!file)
+			return 0;
+
+		FileHeader header;
+		std::vector<char> contents;
+		bool ok = fread(&header, sizeof(header), 1, file) == 1 && header.magic == FILE_MAGIC &&
+		          header.key_size == key.size();
+		if (ok)
+		{
+			contents.resize(header.key_size + header.binary_size);
+			ok = fread(contents.data(), 1, contents.size(), file) == contents.size() &&
+			     !memcmp(contents.data(), key.data(), key.size());
+		}
+		fclose(file);
+		// Another source or device that happens to hash the same
+		if (!ok)
+			return 0;
+
+		GLuint pgm = glCreateProgram();
+		glProgramBinary(pgm, header.format, contents.data() + header.key_size, header.binary_size);
+		GLint status = GL_FALSE;
+		glGetProgramiv(pgm, GL_LINK_STATUS, &status);
+		if (status != GL_TRUE)
+		{
+			// Usually a driver update, the fresh compile replaces it
+			glDeleteProgram(pgm);
+			unlink(path.c_str());
+			s_rejected++;
+			return 0;
+		}
+		s_loaded++;
+		return pgm;
+	}
+
+	static void StoreBinary(const std::string& key, GLuint pgm)
+	{
+		GLint size = 0;
+		glGetProgramiv(pgm, GL_PROGRAM_BINARY_LENGTH, &size);
+		if (size <= 0)
+			return;
+
+		std::vector<char> binary(size);
+		GLenum format;
+		glGetProgramBinary(pgm, size, &size, &format, binary.data());
+
+		// Written aside and renamed, so a reader never sees half a file
+		const std::string path = GetPath(key);
+		const std::string tmp_path = path + "." + std::to_string(getpid());
+		FILE* file = fopen(tmp_path.c_str(), "wb");
+		if (!file)
+			return;
+		const FileHeader header = { FILE_MAGIC, format, (uint32_t)key.size(), (uint32_t)size };
+		const bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		                fwrite(key.data(), 1, key.size(), file) == key.size() &&
+		                fwrite(binary.data(), 1, size, file) == (size_t)size;
+		if (fclose(file) || !ok || rename(tmp_path.c_str(), path.c_str()))
+			unlink(tmp_path.c_str());
+	}
+
+	GLuint CreateComputeProgram(const std::string& src)
+	{
+		return CreateComputePrograms({ src })[0];
+	}
+
+	std::vector<GLuint> CreateComputePrograms(const std::vector<std::string>& srcs)
+	{
+		Init();
+
+		std::vector<GLuint> pgms(srcs.size()), shaders(srcs.size());
+		for (size_t i = 0; i < srcs.size(); ++i)
+		{
+			if (s_binaries && (pgms[i] = LoadBinary(s_device + srcs[i])))
+				continue;
+
+			const char* src = srcs[i].c_str();
+			shaders[i] = glCreateShader(GL_COMPUTE_SHADER);
+			glShaderSource(shaders[i], 1, &src, NULL);
+			glCompileShader(shaders[i]);
+		}
+
+		// Linking waits on its own compile only
+		for (size_t i = 0; i < srcs.size(); ++i)
+		{
+			if (!shaders[i])
+				continue;
+			pgms[i] = glCreateProgram();
+			if (s_binaries)
+				glProgramParameteri(pgms[i], GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+			glAttachShader(pgms[i], shaders[i]);
+			glLinkProgram(pgms[i]);
+		}
+
+		for (size_t i = 0; i < srcs.size(); ++i)
+		{
+			if (!shaders[i])
+				continue;
+			GLUtils::CheckShaderStatus(shaders[i], "cs", srcs[i].c_str());
+			const bool linked = GLUtils::CheckProgramLinkStatus(pgms[i]);
+			glDetachShader(pgms[i], shaders[i]);
+			glDeleteShader(shaders[i]);
+			s_compiled++;
+			if (linked && s_binaries)
+				StoreBinary(s_device + srcs[i], pgms[i]);
+		}
+		return pgms;
+	}
+
+	void PrintStats()
+	{
+		printf("Shader cache: %ld programs loaded, %ld compiled, %ld stale binaries replaced\n",
+			s_loaded, s_compiled, s_rejected);
+	}
+}
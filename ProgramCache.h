@@ -0,0 +1,23 @@
+#pragma once
+
+#include <epoxy/gl.h>
+#include <string>
+#include <vector>
+
+// Compute programs linked from source once, then loaded from glGetProgramBinary dumps.
+// Binaries are keyed on the source and the GL renderer and version, anything the driver
+// refuses is compiled from source again and replaced.
+namespace ProgramCache
+{
+	// Empty, the default, compiles everything from source
+	void SetDirectory(const std::string& dir);
+	// $XDG_CACHE_HOME/gc-decode or ~/.cache/gc-decode
+	std::string GetDefaultDirectory();
+
+	GLuint CreateComputeProgram(const std::string& src);
+	// Starts every compile before waiting on any, so drivers with
+	// GL_KHR_parallel_shader_compile build them side by side
+	std::vector<GLuint> CreateComputePrograms(const std::vector<std::string>& srcs);
+
+	void PrintStats();
+}
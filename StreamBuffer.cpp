@@ -0,0 +1,69 @@
+#include "GPUTimer.h"
+#include "StreamBuffer.h"
+
+bool StreamBuffer::IsSupported()
+{
+	if (epoxy_is_desktop_gl())
+		return epoxy_gl_version() >= 44 || epoxy_has_gl_extension("GL_ARB_buffer_storage");
+	return epoxy_has_gl_extension("GL_EXT_buffer_storage");
+}
+
+StreamBuffer::StreamBuffer(GLenum target, size_t segment_size, int segments)
+	: m_target(target), m_fences(segments, nullptr)
+{
+	// Segments are bound by offset, which has to be aligned
+	GLint align = 1;
+	if (target == GL_TEXTURE_BUFFER)
+		glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &align);
+	m_segment_size = (segment_size + align - 1) / align * align;
+
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &m_buffer);
+	glBindBuffer(m_target, m_buffer);
+	glBufferStorage(m_target, m_segment_size * segments, nullptr, flags);
+	m_ptr = (uint8_t*)glMapBufferRange(m_target, 0, m_segment_size * segments, flags);
+
+	// Start on the first segment
+	m_segment = segments - 1;
+}
+
+StreamBuffer::~StreamBuffer()
+{
+	for (GLsync fence : m_fences)
+		if (fence)
+			glDeleteSync(fence);
+
+	glBindBuffer(m_target, m_buffer);
+	glUnmapBuffer(m_target);
+	glDeleteBuffers(1, &m_buffer);
+}
+
+uint8_t* StreamBuffer::Map()
+{
+	m_segment = (m_segment + 1) % m_fences.size();
+
+	GLsync& fence = m_fences[m_segment];
+	if (fence)
+	{
+		// Only count it when the GPU hasn't caught up yet
+		if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+		{
+			const uint64_t start = CPUTimer::GetTime();
+			glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			m_stall_us += CPUTimer::GetTime() - start;
+			m_stalls++;
+		}
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+
+	return m_ptr + GetOffset();
+}
+
+void StreamBuffer::Fence()
+{
+	GLsync& fence = m_fences[m_segment];
+	if (fence)
+		glDeleteSync(fence);
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <epoxy/gl.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Persistently mapped upload ring. Every Map hands out the next segment, waiting
+// on the fence of its last use first, so the CPU writes straight into memory the
+// GPU reads instead of having the driver copy and reallocate on every upload.
+class StreamBuffer
+{
+public:
+	// Needs GL_EXT_buffer_storage on ES
+	static bool IsSupported();
+
+	StreamBuffer(GLenum target, size_t segment_size, int segments = 3);
+	~StreamBuffer();
+
+	// Pointer to the next segment, segment_size bytes
+	uint8_t* Map();
+	// After the commands reading the mapped segment are submitted
+	void Fence();
+
+	GLuint GetBuffer() const { return m_buffer; }
+	GLenum GetTarget() const { return m_target; }
+	// Bytes of all the segments
+	size_t GetSize() const { return m_segment_size * m_fences.size(); }
+	// Buffer offset of the last mapped segment
+	size_t GetOffset() const { return m_segment * m_segment_size; }
+
+	// Maps that had to wait for the GPU, and how long they waited in total
+	uint64_t GetStalls() const { return m_stalls; }
+	uint64_t GetStallTime() const { return m_stall_us; }
+	void ResetStats() { m_stalls = m_stall_us = 0; }
+
+private:
+	GLenum m_target;
+	GLuint m_buffer;
+	uint8_t* m_ptr;
+	size_t m_segment_size;
+	int m_segment = 0;
+	std::vector<GLsync> m_fences;
+
+	uint64_t m_stalls = 0, m_stall_us = 0;
+};
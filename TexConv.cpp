@@ -0,0 +1,428 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "CPUDecoder.h"
+#include "ThreadPool.h"
+
+// Texture dump: this header, GetEncodedSize(format, width, height) bytes of encoded texture, then
+// for paletted formats GetPaletteSize(format) big-endian TLUT entries. Fields are little-endian.
+struct DumpHeader
+{
+	char magic[4];
+	// GX texture format number
+	uint32_t format;
+	uint32_t width, height;
+	// GX TLUT format number, paletted formats only
+	uint32_t tlut_format;
+	uint32_t reserved[3];
+};
+static_assert(sizeof(DumpHeader) == 32, "dump header is 32 bytes");
+
+static const char DUMP_MAGIC[4] = { 'G', 'X', 'T', 'D' };
+// Alignment and size granularity O_DIRECT writes need on about every file system
+static const size_t DIRECT_BLOCK = 4096;
+
+struct Options
+{
+	std::string out_dir;
+	bool png = false;
+	bool direct = false;
+	// 0 picks std::thread::hardware_concurrency()
+	int threads = 0;
+	CPUKernel kernel = GetBestCPUKernel();
+};
+
+// Page aligned, reused for every file a thread writes
+struct OutputBuffer
+{
+	uint8_t* data = nullptr;
+	size_t capacity = 0;
+
+	~OutputBuffer() { free(data); }
+
+	// Zeroes nothing, the padding past size is whatever was there
+	uint8_t* Reserve(size_t size)
+	{
+		size = (size + DIRECT_BLOCK - 1) / DIRECT_BLOCK * DIRECT_BLOCK;
+		if (size > capacity)
+		{
+			free(data);
+			data = nullptr;
+			capacity = 0;
+			if (posix_memalign((void**)&data, DIRECT_BLOCK, size))
+				return nullptr;
+			capacity = size;
+		}
+		return data;
+	}
+};
+
+static uint32_t UpdateCRC32(uint32_t crc, const uint8_t* data, size_t size)
+{
+	static const std::array<uint32_t, 256> table = []
+	{
+		std::array<uint32_t, 256> t;
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k)
+				c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			t[i] = c;
+		}
+		return t;
+	}();
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; ++i)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+static uint8_t* PutBE32(uint8_t* dst, uint32_t val)
+{
+	dst[0] = val >> 24;
+	dst[1] = val >> 16;
+	dst[2] = val >> 8;
+	dst[3] = val;
+	return dst + 4;
+}
+
+// Stored deflate blocks, PNG wants a zlib stream but not that it's compressed
+static const size_t STORED_BLOCK = 65535;
+
+static size_t GetPNGSize(int width, int height)
+{
+	const size_t raw = (size_t)height * (1 + (size_t)width * 4);
+	const size_t zlib = 2 + raw + 5 * ((raw + STORED_BLOCK - 1) / STORED_BLOCK) + 4;
+	// Signature, IHDR, IDAT and IEND
+	return 8 + 25 + 12 + zlib + 12;
+}
+
+// RGBA8 texels, GetPNGSize(width, height) bytes to dst
+static void WritePNG(uint8_t* dst, const uint32_t* texels, int width, int height)
+{
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	memcpy(dst, signature, 8);
+	uint8_t* out = dst + 8;
+
+	uint8_t* chunk = out;
+	out = PutBE32(out, 13);
+	memcpy(out, "IHDR", 4);
+	out = PutBE32(out + 4, width);
+	out = PutBE32(out, height);
+	// 8 bits per channel RGBA, deflate, adaptive filtering, no interlace
+	const uint8_t ihdr[5] = { 8, 6, 0, 0, 0 };
+	memcpy(out, ihdr, 5);
+	out += 5;
+	out = PutBE32(out, UpdateCRC32(0, chunk + 4, 17));
+
+	const size_t row = 1 + (size_t)width * 4;
+	const size_t raw = row * height;
+	chunk = out;
+	out = PutBE32(out, GetPNGSize(width, height) - 8 - 25 - 12 - 12);
+	memcpy(out, "IDAT", 4);
+	out += 4;
+	// zlib header for deflate with a 32K window, no dictionary
+	*out++ = 0x78;
+	*out++ = 0x01;
+
+	uint32_t a = 1, b = 0;
+	size_t left = raw, pos = 0;
+	while (left)
+	{
+		const size_t len = std::min(left, STORED_BLOCK);
+		left -= len;
+		*out++ = left ? 0 : 1;
+		*out++ = len;
+		*out++ = len >> 8;
+		*out++ = ~len;
+		*out++ = ~len >> 8;
+
+		// Every row starts with filter type 0, then the texels as they are
+		for (size_t end = pos + len; pos < end; )
+		{
+			const size_t x = pos % row;
+			const size_t n = x ? std::min(row - x, end - pos) : 1;
+			if (x)
+				memcpy(out, (const uint8_t*)&texels[(pos / row) * width] + x - 1, n);
+			else
+				*out = 0;
+
+			for (size_t i = 0; i < n; ++i)
+			{
+				a = (a + out[i]) % 65521;
+				b = (b + a) % 65521;
+			}
+			out += n;
+			pos += n;
+		}
+	}
+	out = PutBE32(out, (b << 16) | a);
+	out = PutBE32(out, UpdateCRC32(0, chunk + 4, out - chunk - 4));
+
+	out = PutBE32(out, 0);
+	memcpy(out, "IEND", 4);
+	PutBE32(out + 4, UpdateCRC32(0, out, 4));
+}
+
+// O_DIRECT writes whole blocks straight from buf and truncates the padding off after. Falls back to
+// a buffered write where the file system won't do direct I/O.
+static bool WriteOutput(const std::string& path, const uint8_t* buf, size_t size, bool direct)
+{
+	int fd = direct ? open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644) : -1;
+	if (fd < 0)
+	{
+		direct = false;
+		fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if (fd < 0)
+	{
+		printf("%s: %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+
+	const size_t total = direct ? (size + DIRECT_BLOCK - 1) / DIRECT_BLOCK * DIRECT_BLOCK : size;
+	for (size_t done = 0; done < total; )
+	{
+		const ssize_t n = write(fd, buf + done, total - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			printf("%s: %s\n", path.c_str(), n < 0 ? strerror(errno) : "short write");
+			close(fd);
+			return false;
+		}
+		done += n;
+	}
+	if (direct && total != size && ftruncate(fd, size))
+	{
+		printf("%s: %s\n", path.c_str(), strerror(errno));
+		close(fd);
+		return false;
+	}
+	close(fd);
+	return true;
+}
+
+static std::string GetOutputPath(const std::string& input, const Options& opts)
+{
+	const size_t slash = input.rfind('/');
+	std::string name = slash == std::string::npos ? input : input.substr(slash + 1);
+	const size_t dot = name.rfind('.');
+	if (dot != std::string::npos && dot)
+		name.resize(dot);
+	name += opts.png ? ".png" : ".rgba";
+
+	if (opts.out_dir.empty())
+		return slash == std::string::npos ? name : input.substr(0, slash + 1) + name;
+	return opts.out_dir + "/" + name;
+}
+
+// Bytes read and written, 0 for a file that couldn't be converted
+static std::pair<size_t, size_t> ConvertFile(const std::string& path, const Options& opts)
+{
+	const int fd = open(path.c_str(), O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st))
+	{
+		printf("%s: %s\n", path.c_str(), strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return { 0, 0 };
+	}
+
+	const size_t size = st.st_size;
+	// Faulted in up front, a read-ahead for cold files and free for cached ones
+	void* map = size >= sizeof(DumpHeader) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		printf("%s: %s\n", path.c_str(), size < sizeof(DumpHeader) ? "too small for a dump" : strerror(errno));
+		return { 0, 0 };
+	}
+	madvise(map, size, MADV_SEQUENTIAL);
+
+	DumpHeader header;
+	memcpy(&header, map, sizeof(header));
+	TexType type;
+	const char* error = nullptr;
+	if (memcmp(header.magic, DUMP_MAGIC, 4))
+		error = "not a texture dump";
+	else if (!GetTexTypeFromGX(header.format, &type))
+		error = "unknown texture format";
+	else if (!header.width || !header.height || header.width > 16384 || header.height > 16384)
+		error = "bad dimensions";
+	else if (IsPaletted(type) && header.tlut_format >= (uint32_t)TlutFormat::COUNT)
+		error = "unknown TLUT format";
+
+	const int width = header.width, height = header.height;
+	const size_t encoded = error ? 0 : GetEncodedSize(type, width, height);
+	const size_t tlut = error || !IsPaletted(type) ? 0 : GetPaletteSize(type) * 2;
+	if (!error && size < sizeof(DumpHeader) + encoded + tlut)
+		error = "truncated";
+	if (error)
+	{
+		printf("%s: %s\n", path.c_str(), error);
+		munmap(map, size);
+		return { 0, 0 };
+	}
+
+	// The kernels only read, the mapping stays read-only
+	uint8_t* src = (uint8_t*)map + sizeof(DumpHeader);
+	const uint8_t* palette = tlut ? src + encoded : nullptr;
+	const TlutFormat tlut_fmt = (TlutFormat)header.tlut_format;
+
+	// Raw output is decoded straight into the write buffer
+	static thread_local OutputBuffer out;
+	static thread_local std::vector<uint32_t> texels;
+	const size_t texel_bytes = (size_t)width * height * 4;
+	const size_t out_size = opts.png ? GetPNGSize(width, height) : texel_bytes;
+	uint8_t* dst = out.Reserve(out_size);
+	if (!dst)
+	{
+		printf("%s: out of memory\n", path.c_str());
+		munmap(map, size);
+		return { 0, 0 };
+	}
+	uint32_t* decoded = (uint32_t*)dst;
+	if (opts.png)
+	{
+		texels.resize((size_t)width * height);
+		decoded = &texels[0];
+	}
+
+	const TexInfo info = GetTexInfo(type);
+	if (width % info.block_w || height % info.block_h)
+		DecodeRectOnCPU(opts.kernel, decoded, src, width, height, type, 0, 0, width, height, palette, tlut_fmt);
+	else
+		DecodeOnCPU(opts.kernel, decoded, src, width, height, type, palette, tlut_fmt);
+	munmap(map, size);
+
+	if (opts.png)
+		WritePNG(dst, decoded, width, height);
+	if (!WriteOutput(GetOutputPath(path, opts), dst, out_size, opts.direct))
+		return { 0, 0 };
+	return { size, out_size };
+}
+
+// Directories stand for the files in them, not recursing
+static void AddInput(const char* path, std::vector<std::string>* files)
+{
+	struct stat st;
+	if (stat(path, &st) || !S_ISDIR(st.st_mode))
+	{
+		files->push_back(path);
+		return;
+	}
+
+	DIR* dir = opendir(path);
+	if (!dir)
+	{
+		printf("%s: %s\n", path, strerror(errno));
+		return;
+	}
+	std::vector<std::string> names;
+	while (struct dirent* entry = readdir(dir))
+	{
+		const std::string name = std::string(path) + "/" + entry->d_name;
+		if (!stat(name.c_str(), &st) && S_ISREG(st.st_mode))
+			names.push_back(name);
+	}
+	closedir(dir);
+	std::sort(names.begin(), names.end());
+	files->insert(files->end(), names.begin(), names.end());
+}
+
+static void PrintUsage(const char* name)
+{
+	printf("Usage: %s [--out=dir] [--png] [--direct] [--threads=N] [--kernel=name] <dump file or dir>...\n"
+	       "Decodes texture dumps to raw RGBA8 (.rgba) or PNG, next to the input or in --out.\n"
+	       "Files are converted in parallel, --threads=0 uses every core. --direct writes with O_DIRECT.\n"
+	       "Kernels:", name);
+	for (int i = 0; i < (int)CPUKernel::COUNT; ++i)
+		if (IsCPUKernelSupported((CPUKernel)i))
+			printf(" %s", GetCPUKernelName((CPUKernel)i));
+	printf(" (default %s)\n", GetCPUKernelName(GetBestCPUKernel()));
+}
+
+int main(int argc, char** argv)
+{
+	Options opts;
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		bool ok = true;
+		if (!strncmp(arg, "--out=", 6))
+			opts.out_dir = arg + 6;
+		else if (!strcmp(arg, "--png"))
+			opts.png = true;
+		else if (!strcmp(arg, "--direct"))
+			opts.direct = true;
+		else if (!strncmp(arg, "--threads=", 10))
+			ok = (opts.threads = atoi(arg + 10)) >= 0;
+		else if (!strncmp(arg, "--kernel=", 9))
+		{
+			ok = false;
+			for (int k = 0; k < (int)CPUKernel::COUNT; ++k)
+				if (!strcasecmp(arg + 9, GetCPUKernelName((CPUKernel)k)) && IsCPUKernelSupported((CPUKernel)k))
+				{
+					opts.kernel = (CPUKernel)k;
+					ok = true;
+				}
+		}
+		else if (!strncmp(arg, "--", 2))
+			ok = false;
+		else
+			AddInput(arg, &files);
+
+		if (!ok)
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+	if (files.empty())
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	// Whole files per thread, each decoded single threaded
+	const int threads = opts.threads ? opts.threads : std::max(1u, std::thread::hardware_concurrency());
+	ThreadPool pool(std::min(threads, (int)files.size()));
+	std::atomic<uint64_t> read_bytes(0), written_bytes(0);
+	std::atomic<int> failed(0);
+
+	const auto begin = std::chrono::steady_clock::now();
+	pool.Run(files.size(), [&](int i)
+	{
+		const std::pair<size_t, size_t> bytes = ConvertFile(files[i], opts);
+		if (!bytes.second)
+			failed++;
+		read_bytes += bytes.first;
+		written_bytes += bytes.second;
+	});
+	const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	printf("%d of %d files with %s on %d threads in %.0fms: %.1fMB read (%.1fMB/s), %.1fMB written (%.1fMB/s)\n",
+		(int)files.size() - failed.load(), (int)files.size(), GetCPUKernelName(opts.kernel), pool.GetThreadCount(),
+		secs * 1000, read_bytes / 1e6, read_bytes / 1e6 / secs, written_bytes / 1e6, written_bytes / 1e6 / secs);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,74 @@
+#include "GLUtils.h"
+#include "TextureCache.h"
+
+TextureCache::TextureCache(size_t budget)
+{
+	m_stats.budget = budget;
+}
+
+TextureCache::~TextureCache()
+{
+	Clear();
+}
+
+GLuint TextureCache::Get(const Key& key, bool* hit)
+{
+	auto it = m_entries.find(key);
+	if (it != m_entries.end())
+	{
+		m_lru.splice(m_lru.begin(), m_lru, it->second);
+		m_stats.hits++;
+		*hit = true;
+		return it->second->tex;
+	}
+
+	m_stats.misses++;
+	*hit = false;
+
+	// One that's over budget on its own still gets cached, alone
+	const size_t size = GLUtils::GetTextureSize(key.format, key.width, key.height);
+	EvictTo(m_stats.budget > size ? m_stats.budget - size : 0);
+
+	GLuint tex;
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexStorage2D(GL_TEXTURE_2D, 1, key.format, key.width, key.height);
+
+	m_lru.push_front({ key, tex, size });
+	m_entries[key] = m_lru.begin();
+	m_stats.used += size;
+	m_stats.entries++;
+	return tex;
+}
+
+void TextureCache::EvictTo(size_t budget)
+{
+	while (m_stats.used > budget && !m_lru.empty())
+	{
+		const Entry& entry = m_lru.back();
+		glDeleteTextures(1, &entry.tex);
+		m_stats.used -= entry.size;
+		m_stats.entries--;
+		m_stats.evictions++;
+		m_entries.erase(entry.key);
+		m_lru.pop_back();
+	}
+}
+
+void TextureCache::Clear()
+{
+	for (const Entry& entry : m_lru)
+		glDeleteTextures(1, &entry.tex);
+	m_lru.clear();
+	m_entries.clear();
+	m_stats.used = 0;
+	m_stats.entries = 0;
+}
+
+void TextureCache::SetBudget(size_t budget)
+{
+	m_stats.budget = budget;
+	EvictTo(budget);
+}
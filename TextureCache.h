@@ -0,0 +1,71 @@
+#pragma once
+
+#include <list>
+#include <unordered_map>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <epoxy/gl.h>
+
+#include "DecodeTypes.h"
+
+// Decoded textures by format, size and a hash of the encoded bytes (and TLUT).
+// Least recently used ones are deleted once they don't fit the budget.
+class TextureCache
+{
+public:
+	struct Key
+	{
+		TexType type;
+		int width, height;
+		// Internal format of the decoded texture, GL_RGBA8UI, a narrow one or a BC1 one
+		GLenum format;
+		uint64_t hash;
+
+		bool operator==(const Key& other) const
+		{
+			return type == other.type && width == other.width && height == other.height &&
+			       format == other.format && hash == other.hash;
+		}
+	};
+
+	struct Stats
+	{
+		uint64_t hits = 0, misses = 0, evictions = 0;
+		size_t used = 0, budget = 0;
+		int entries = 0;
+	};
+
+	explicit TextureCache(size_t budget);
+	~TextureCache();
+
+	// On a hit the texture decoded for key before. Otherwise a new texture for the caller
+	// to decode into, after evicting whatever it takes to fit it in the budget.
+	// A texture stays valid until the next Get or Clear.
+	GLuint Get(const Key& key, bool* hit);
+	void Clear();
+	// Evicts right away if the cache is over the new budget
+	void SetBudget(size_t budget);
+
+	const Stats& GetStats() const { return m_stats; }
+
+private:
+	struct Entry
+	{
+		Key key;
+		GLuint tex;
+		size_t size;
+	};
+
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const { return (size_t)key.hash; }
+	};
+
+	void EvictTo(size_t budget);
+
+	// Most recently used first
+	std::list<Entry> m_lru;
+	std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_entries;
+	Stats m_stats;
+};
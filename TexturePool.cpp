@@ -0,0 +1,206 @@
+#include <iterator>
+#include <tuple>
+
+#include "DecodeTypes.h"
+#include "GLUtils.h"
+#include "TexturePool.h"
+
+bool TexturePool::Key::operator<(const Key& other) const
+{
+	return std::tie(kind, format, width, height, levels, size) <
+	       std::tie(other.kind, other.format, other.width, other.height, other.levels, other.size);
+}
+
+TexturePool::TexturePool(size_t budget)
+{
+	m_stats.budget = budget;
+}
+
+TexturePool::~TexturePool()
+{
+	Clear();
+}
+
+GLuint TexturePool::GetTexture(GLenum format, int width, int height, int levels)
+{
+	const Key key = { Kind::TEXTURE, format, width, height, levels, 0 };
+	Entry entry;
+	if (!Reuse(key, &entry))
+	{
+		glGenTextures(1, &entry.name);
+		glBindTexture(GL_TEXTURE_2D, entry.name);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexStorage2D(GL_TEXTURE_2D, levels, format, width, height);
+	}
+	m_textures[entry.name] = key;
+	return entry.name;
+}
+
+GLuint TexturePool::GetBufferTexture()
+{
+	const Key key = { Kind::BUFFER_TEXTURE, 0, 0, 0, 0, 0 };
+	Entry entry;
+	if (!Reuse(key, &entry))
+		glGenTextures(1, &entry.name);
+	m_textures[entry.name] = key;
+	return entry.name;
+}
+
+GLuint TexturePool::GetBuffer(size_t size, GLenum usage)
+{
+	const Key key = { Kind::BUFFER, usage, 0, 0, 0, size };
+	Entry entry;
+	if (!Reuse(key, &entry))
+	{
+		glGenBuffers(1, &entry.name);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, entry.name);
+		glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, usage);
+	}
+	m_buffers[entry.name] = key;
+	return entry.name;
+}
+
+std::unique_ptr<StreamBuffer> TexturePool::GetStreamBuffer(GLenum target, size_t segment_size)
+{
+	const Key key = { Kind::STREAM, target, 0, 0, 0, segment_size };
+	Entry entry;
+	if (!Reuse(key, &entry))
+		entry.stream.reset(new StreamBuffer(target, segment_size));
+	m_streams[entry.stream.get()] = key;
+	return std::move(entry.stream);
+}
+
+void TexturePool::ReleaseTexture(GLuint tex)
+{
+	auto it = m_textures.find(tex);
+	if (it == m_textures.end())
+		return;
+
+	Entry entry = { it->second, tex, nullptr };
+	m_textures.erase(it);
+	// Or the buffer it was attached to stays alive as long as the texture
+	if (entry.key.kind == Kind::BUFFER_TEXTURE)
+	{
+		glBindTexture(GL_TEXTURE_BUFFER, tex);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_R8UI, 0);
+	}
+	Pool(std::move(entry));
+}
+
+void TexturePool::ReleaseBuffer(GLuint buf)
+{
+	auto it = m_buffers.find(buf);
+	if (it == m_buffers.end())
+		return;
+
+	Entry entry = { it->second, buf, nullptr };
+	m_buffers.erase(it);
+	Pool(std::move(entry));
+}
+
+void TexturePool::ReleaseStreamBuffer(std::unique_ptr<StreamBuffer> stream)
+{
+	auto it = m_streams.find(stream.get());
+	if (it == m_streams.end())
+		return;
+
+	// Its fences keep the next user from writing segments the GPU still reads
+	Entry entry = { it->second, 0, std::move(stream) };
+	m_streams.erase(it);
+	Pool(std::move(entry));
+}
+
+bool TexturePool::Reuse(const Key& key, Entry* entry)
+{
+	auto it = m_entries.find(key);
+	if (it == m_entries.end())
+	{
+		m_stats.allocations++;
+		return false;
+	}
+
+	*entry = std::move(*it->second);
+	m_lru.erase(it->second);
+	m_entries.erase(it);
+	m_stats.pooled -= GetSize(*entry);
+	m_stats.entries--;
+	m_stats.reuses++;
+	return true;
+}
+
+size_t TexturePool::GetSize(const Entry& entry)
+{
+	switch (entry.key.kind)
+	{
+	case Kind::TEXTURE:
+	{
+		size_t size = 0;
+		for (int level = 0; level < entry.key.levels; ++level)
+			size += GLUtils::GetTextureSize(entry.key.format, GetMipSize(entry.key.width, level),
+				GetMipSize(entry.key.height, level));
+		return size;
+	}
+	case Kind::BUFFER:
+		return entry.key.size;
+	case Kind::STREAM:
+		return entry.stream->GetSize();
+	default:
+		return 0;
+	}
+}
+
+void TexturePool::Pool(Entry entry)
+{
+	m_stats.pooled += GetSize(entry);
+	m_stats.entries++;
+	m_lru.push_front(std::move(entry));
+	m_entries.emplace(m_lru.front().key, m_lru.begin());
+	TrimTo(m_stats.budget);
+}
+
+void TexturePool::Delete(Entry* entry)
+{
+	if (entry->key.kind == Kind::TEXTURE || entry->key.kind == Kind::BUFFER_TEXTURE)
+		glDeleteTextures(1, &entry->name);
+	else if (entry->key.kind == Kind::BUFFER)
+		glDeleteBuffers(1, &entry->name);
+	entry->stream.reset();
+}
+
+void TexturePool::TrimTo(size_t budget)
+{
+	// Buffer textures take no storage, only a budget of 0 deletes them
+	while (!m_lru.empty() && (m_stats.pooled > budget || !budget))
+	{
+		auto last = std::prev(m_lru.end());
+		auto range = m_entries.equal_range(last->key);
+		for (auto it = range.first; it != range.second; ++it)
+			if (it->second == last)
+			{
+				m_entries.erase(it);
+				break;
+			}
+		m_stats.pooled -= GetSize(*last);
+		Delete(&*last);
+		m_stats.entries--;
+		m_stats.trims++;
+		m_lru.pop_back();
+	}
+}
+
+void TexturePool::Clear()
+{
+	for (Entry& entry : m_lru)
+		Delete(&entry);
+	m_lru.clear();
+	m_entries.clear();
+	m_stats.pooled = 0;
+	m_stats.entries = 0;
+}
+
+void TexturePool::SetBudget(size_t budget)
+{
+	m_stats.budget = budget;
+	TrimTo(budget);
+}
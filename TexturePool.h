@@ -0,0 +1,99 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <epoxy/gl.h>
+
+#include "StreamBuffer.h"
+
+// GL objects TextureConverts are done with, handed to the next one asking for the same kind instead
+// of being deleted, so textures coming and going in steady state create nothing new in the driver.
+// Textures go by internal format, size and levels, buffers by size and usage. Whatever sat unused
+// longest is deleted once the pooled objects take more than the budget.
+class TexturePool
+{
+public:
+	struct Stats
+	{
+		// GL objects created, and pooled ones handed out again
+		uint64_t allocations = 0, reuses = 0;
+		// Deleted to fit the budget
+		uint64_t trims = 0;
+		size_t pooled = 0, budget = 0;
+		int entries = 0;
+	};
+
+	// 0 pools nothing, everything released is deleted right away
+	explicit TexturePool(size_t budget);
+	~TexturePool();
+
+	// 2D texture with storage for levels, filtered GL_NEAREST when new. A pooled one keeps its
+	// contents and whatever parameters its last user set.
+	GLuint GetTexture(GLenum format, int width, int height, int levels);
+	// Buffer texture, attached to no buffer
+	GLuint GetBufferTexture();
+	// size bytes of storage with undefined contents. glBufferData may replace the storage, with
+	// the same size.
+	GLuint GetBuffer(size_t size, GLenum usage);
+	std::unique_ptr<StreamBuffer> GetStreamBuffer(GLenum target, size_t segment_size);
+
+	// Only for what the Gets handed out, 0 and null are ignored
+	void ReleaseTexture(GLuint tex);
+	void ReleaseBuffer(GLuint buf);
+	void ReleaseStreamBuffer(std::unique_ptr<StreamBuffer> stream);
+
+	void Clear();
+	// Trims right away if the pool is over the new budget
+	void SetBudget(size_t budget);
+
+	const Stats& GetStats() const { return m_stats; }
+
+private:
+	enum class Kind
+	{
+		TEXTURE,
+		BUFFER_TEXTURE,
+		BUFFER,
+		STREAM,
+	};
+
+	struct Key
+	{
+		Kind kind;
+		// Internal format of a texture, usage of a buffer or target of a stream buffer
+		GLenum format;
+		int width, height, levels;
+		// Bytes of a buffer, segment bytes asked for of a stream buffer
+		size_t size;
+
+		bool operator<(const Key& other) const;
+	};
+
+	struct Entry
+	{
+		Key key;
+		GLuint name;
+		std::unique_ptr<StreamBuffer> stream;
+	};
+
+	// Moves a pooled entry for key out into entry, false when there is none
+	bool Reuse(const Key& key, Entry* entry);
+	void Pool(Entry entry);
+	// Bytes of storage behind it
+	static size_t GetSize(const Entry& entry);
+	void Delete(Entry* entry);
+	void TrimTo(size_t budget);
+
+	// Most recently released first
+	std::list<Entry> m_lru;
+	std::multimap<Key, std::list<Entry>::iterator> m_entries;
+	// Handed out, by name or stream buffer
+	std::unordered_map<GLuint, Key> m_textures, m_buffers;
+	std::unordered_map<StreamBuffer*, Key> m_streams;
+	Stats m_stats;
+};
@@ -0,0 +1,80 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int threads)
+	: m_next_job(0)
+{
+	for (int i = 1; i < threads; ++i)
+		m_workers.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lk(m_lock);
+		m_quit = true;
+	}
+	m_wake.notify_all();
+
+	for (auto& worker : m_workers)
+		worker.join();
+}
+
+void ThreadPool::DoJobs()
+{
+	int job;
+	while ((job = m_next_job.fetch_add(1)) < m_num_jobs)
+		(*m_func)(job);
+}
+
+void ThreadPool::WorkerLoop()
+{
+	uint64_t generation = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lk(m_lock);
+			m_wake.wait(lk, [&] { return m_quit || m_generation != generation; });
+			if (m_quit)
+				return;
+			generation = m_generation;
+		}
+
+		DoJobs();
+
+		std::lock_guard<std::mutex> lk(m_lock);
+		if (--m_busy_workers == 0)
+			m_done.notify_one();
+	}
+}
+
+void ThreadPool::Run(int jobs, const std::function<void(int)>& func)
+{
+	if (jobs <= 0)
+		return;
+
+	// Not worth waking anyone up for
+	if (jobs == 1 || m_workers.empty())
+	{
+		for (int i = 0; i < jobs; ++i)
+			func(i);
+		return;
+	}
+
+	std::lock_guard<std::mutex> run_lk(m_run_lock);
+	{
+		std::lock_guard<std::mutex> lk(m_lock);
+		m_func = &func;
+		m_num_jobs = jobs;
+		m_next_job = 0;
+		m_busy_workers = m_workers.size();
+		m_generation++;
+	}
+	m_wake.notify_all();
+
+	DoJobs();
+
+	// Workers still hold a pointer to func until they check back in
+	std::unique_lock<std::mutex> lk(m_lock);
+	m_done.wait(lk, [&] { return m_busy_workers == 0; });
+	m_func = nullptr;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker pool for fork/join style work.
+// The thread calling Run() also takes jobs, so a pool of N threads owns N - 1 workers.
+class ThreadPool
+{
+public:
+	ThreadPool(int threads);
+	~ThreadPool();
+
+	// Calls func(0 .. jobs - 1) across the pool and returns once every job is done
+	void Run(int jobs, const std::function<void(int)>& func);
+
+	int GetThreadCount() const { return (int)m_workers.size() + 1; }
+
+private:
+	void WorkerLoop();
+	void DoJobs();
+
+	std::vector<std::thread> m_workers;
+
+	// Only one Run() in flight at a time
+	std::mutex m_run_lock;
+
+	std::mutex m_lock;
+	std::condition_variable m_wake, m_done;
+	const std::function<void(int)>* m_func = nullptr;
+	std::atomic<int> m_next_job;
+	int m_num_jobs = 0;
+	int m_busy_workers = 0;
+	uint64_t m_generation = 0;
+	bool m_quit = false;
+};
@@ -0,0 +1,261 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Hash.h"
+#include "Trace.h"
+
+static const char TRACE_MAGIC[4] = { 'G', 'X', 'T', 'R' };
+static const uint32_t TRACE_VERSION = 1;
+static const size_t HEADER_SIZE = 8;
+
+enum : uint8_t
+{
+	RECORD_FRAME = 1,
+	RECORD_TEXTURE = 2,
+};
+static const size_t FRAME_SIZE = 9;
+static const size_t TEXTURE_SIZE = 24;
+
+// Records are packed, so fields go in and out one by one
+template <typename T>
+static uint8_t* Put(uint8_t* dst, T val)
+{
+	memcpy(dst, &val, sizeof(T));
+	return dst + sizeof(T);
+}
+
+template <typename T>
+static const uint8_t* Get(const uint8_t* src, T* val)
+{
+	memcpy(val, src, sizeof(T));
+	return src + sizeof(T);
+}
+
+TraceWriter::~TraceWriter()
+{
+	Close();
+}
+
+bool TraceWriter::Open(const char* path)
+{
+	Close();
+	m_file = fopen(path, "wb");
+	if (!m_file)
+	{
+		printf("Trace %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	m_pos = 0;
+	m_stored.clear();
+	m_stats = Stats();
+	m_start = std::chrono::steady_clock::now();
+	Write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+	Write(&TRACE_VERSION, sizeof(TRACE_VERSION));
+	return true;
+}
+
+void TraceWriter::Close()
+{
+	if (!m_file)
+		return;
+	fclose(m_file);
+	m_file = nullptr;
+	printf("Trace: %ld frames, %ld textures, %ld unique and %ld unique TLUTs, %.1fMB decoded in %.1fMB\n",
+		m_stats.frames, m_stats.textures, m_stats.unique, m_stats.unique_tluts,
+		m_stats.bytes / (1024.0 * 1024.0), m_stats.written / (1024.0 * 1024.0));
+}
+
+void TraceWriter::Write(const void* bytes, size_t size)
+{
+	fwrite(bytes, 1, size, m_file);
+	m_pos += size;
+	m_stats.written += size;
+}
+
+uint64_t TraceWriter::Store(const uint8_t* bytes, size_t size, uint64_t pos, bool* added)
+{
+	auto stored = m_stored.emplace(std::make_pair(XXH64(bytes, size), size), pos);
+	*added = stored.second;
+	return stored.first->second;
+}
+
+void TraceWriter::AddTexture(TexType type, int width, int height, int levels, const uint8_t* data,
+                             const uint8_t* tlut, TlutFormat tlut_fmt)
+{
+	if (!m_file)
+		return;
+
+	const size_t size = GetMipChainEncodedSize(type, width, height, levels);
+	const size_t tlut_size = IsPaletted(type) ? GetPaletteSize(type) * 2 : 0;
+	bool new_data, new_tlut = false;
+	const uint64_t data_offset = Store(data, size, m_pos + TEXTURE_SIZE, &new_data);
+	const uint64_t tlut_offset = !tlut_size ? 0 :
+		Store(tlut, tlut_size, m_pos + TEXTURE_SIZE + (new_data ? size : 0), &new_tlut);
+
+	uint8_t record[TEXTURE_SIZE];
+	uint8_t* dst = Put<uint8_t>(record, RECORD_TEXTURE);
+	dst = Put<uint8_t>(dst, GetGXFormat(type));
+	dst = Put<uint8_t>(dst, (uint8_t)tlut_fmt);
+	dst = Put<uint8_t>(dst, levels);
+	dst = Put<uint16_t>(dst, width);
+	dst = Put<uint16_t>(dst, height);
+	dst = Put<uint64_t>(dst, data_offset);
+	Put<uint64_t>(dst, tlut_offset);
+	Write(record, sizeof(record));
+	if (new_data)
+		Write(data, size);
+	if (new_tlut)
+		Write(tlut, tlut_size);
+
+	m_stats.textures++;
+	m_stats.unique += new_data;
+	m_stats.unique_tluts += new_tlut;
+	m_stats.bytes += size + tlut_size;
+}
+
+void TraceWriter::EndFrame()
+{
+	if (!m_file)
+		return;
+
+	const uint64_t time = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - m_start).count();
+	uint8_t record[FRAME_SIZE];
+	Put<uint64_t>(Put<uint8_t>(record, RECORD_FRAME), time);
+	Write(record, sizeof(record));
+	fflush(m_file);
+	m_stats.frames++;
+}
+
+TraceReader::~TraceReader()
+{
+	if (m_map)
+		munmap((void*)m_map, m_size);
+}
+
+bool TraceReader::Open(const char* path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		printf("Trace %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	struct stat st;
+	const size_t size = fstat(fd, &st) ? 0 : st.st_size;
+	void* map = size >= HEADER_SIZE ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		printf("Trace %s: %s\n", path, size < HEADER_SIZE ? "too small for a trace" : strerror(errno));
+		return false;
+	}
+	// Read front to back, apart from data that comes around again
+	madvise(map, size, MADV_SEQUENTIAL);
+
+	uint32_t version;
+	Get((const uint8_t*)map + sizeof(TRACE_MAGIC), &version);
+	if (memcmp(map, TRACE_MAGIC, sizeof(TRACE_MAGIC)) || version != TRACE_VERSION)
+	{
+		printf("Trace %s: %s\n", path, version != TRACE_VERSION ? "unknown version" : "not a trace");
+		munmap(map, size);
+		return false;
+	}
+
+	if (m_map)
+		munmap((void*)m_map, m_size);
+	m_map = (const uint8_t*)map;
+	m_size = size;
+	m_pos = HEADER_SIZE;
+	return true;
+}
+
+void TraceReader::Rewind()
+{
+	m_pos = HEADER_SIZE;
+}
+
+bool TraceReader::Next(Event* event)
+{
+	if (m_pos >= m_size)
+		return false;
+
+	const uint8_t kind = m_map[m_pos];
+	const char* error = nullptr;
+	if (kind == RECORD_FRAME)
+	{
+		if (m_size - m_pos < FRAME_SIZE)
+			error = "cut off";
+		else
+		{
+			event->kind = Event::Kind::FRAME;
+			Get(&m_map[m_pos + 1], &event->time);
+			m_pos += FRAME_SIZE;
+			return true;
+		}
+	}
+	else if (kind == RECORD_TEXTURE)
+	{
+		uint8_t format, tlut_fmt, levels;
+		uint16_t width, height;
+		uint64_t data_offset, tlut_offset;
+		const uint8_t* src = &m_map[m_pos + 1];
+		if (m_size - m_pos < TEXTURE_SIZE)
+			error = "cut off";
+		else
+		{
+			src = Get(Get(Get(src, &format), &tlut_fmt), &levels);
+			src = Get(Get(src, &width), &height);
+			Get(Get(src, &data_offset), &tlut_offset);
+			if (!GetTexTypeFromGX(format, &event->type))
+				error = "unknown texture format";
+			else if (!width || !height || !levels || levels > GetMipLevelCount(width, height))
+				error = "bad dimensions";
+			else if (IsPaletted(event->type) && tlut_fmt >= (uint8_t)TlutFormat::COUNT)
+				error = "unknown TLUT format";
+		}
+
+		// Either right after what was read so far, or somewhere in it
+		uint64_t end = m_pos + TEXTURE_SIZE;
+		auto Locate = [&](uint64_t offset, size_t size) -> const uint8_t*
+		{
+			if (offset == end && size <= m_size - end)
+			{
+				end += size;
+				return &m_map[offset];
+			}
+			if (offset >= HEADER_SIZE && offset + size <= end)
+				return &m_map[offset];
+			error = offset == end ? "cut off" : "bad data offset";
+			return nullptr;
+		};
+		if (!error)
+		{
+			event->kind = Event::Kind::TEXTURE;
+			event->tlut_fmt = (TlutFormat)tlut_fmt;
+			event->width = width;
+			event->height = height;
+			event->levels = levels;
+			event->data = Locate(data_offset, GetMipChainEncodedSize(event->type, width, height, levels));
+			event->tlut = nullptr;
+			if (!error && IsPaletted(event->type))
+				event->tlut = Locate(tlut_offset, GetPaletteSize(event->type) * 2);
+		}
+		if (!error)
+		{
+			m_pos = end;
+			return true;
+		}
+	}
+	else
+		error = "unknown record";
+
+	printf("Trace: %s at %zu, stopping there\n", error, m_pos);
+	m_pos = m_size;
+	return false;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <utility>
+
+#include "DecodeTypes.h"
+
+// Decode traces: the textures decoded frame after frame, for replaying the same work later.
+// A "GXTR" magic and a version, then records, all fields little-endian:
+//   FRAME    u8 1, u64 us since the capture started, at the end of the frame
+//   TEXTURE  u8 2, u8 GX format, u8 GX TLUT format, u8 mip levels, u16 width, u16 height,
+//            u64 offset of the encoded data, u64 offset of the TLUT (paletted formats only)
+// Encoded data and TLUTs are stored once: data seen for the first time follows its record, the
+// encoded data before the TLUT, and later records point back at it.
+class TraceWriter
+{
+public:
+	struct Stats
+	{
+		uint64_t frames = 0, textures = 0;
+		// Encoded data and TLUTs not seen before
+		uint64_t unique = 0, unique_tluts = 0;
+		// Bytes decoded, and bytes of trace those took
+		uint64_t bytes = 0, written = 0;
+	};
+
+	~TraceWriter();
+
+	bool Open(const char* path);
+	// Prints the stats, nothing is written after this
+	void Close();
+
+	// data is GetMipChainEncodedSize(type, width, height, levels) bytes, tlut GetPaletteSize(type)
+	// big-endian entries for paletted formats and ignored for the rest
+	void AddTexture(TexType type, int width, int height, int levels, const uint8_t* data,
+	                const uint8_t* tlut, TlutFormat tlut_fmt);
+	// Flushed, so a capture that gets killed still replays up to its last frame
+	void EndFrame();
+
+	const Stats& GetStats() const { return m_stats; }
+
+private:
+	// Offset of the bytes in the trace, written after pos when they're new
+	uint64_t Store(const uint8_t* bytes, size_t size, uint64_t pos, bool* added);
+	void Write(const void* bytes, size_t size);
+
+	FILE* m_file = nullptr;
+	uint64_t m_pos = 0;
+	// Offsets by hash and size
+	std::map<std::pair<uint64_t, size_t>, uint64_t> m_stored;
+	std::chrono::steady_clock::time_point m_start;
+	Stats m_stats;
+};
+
+// Reads a trace through a memory map, the data of every event points into it
+class TraceReader
+{
+public:
+	struct Event
+	{
+		enum class Kind { FRAME, TEXTURE };
+		Kind kind;
+		// FRAME only
+		uint64_t time;
+		// TEXTURE only
+		TexType type;
+		TlutFormat tlut_fmt;
+		int width, height, levels;
+		const uint8_t* data;
+		// Null for formats without a TLUT
+		const uint8_t* tlut;
+	};
+
+	~TraceReader();
+
+	bool Open(const char* path);
+	// False at the end of the trace, and at a bad or cut off record after printing what's wrong
+	bool Next(Event* event);
+	// Back to the first record
+	void Rewind();
+	size_t GetSize() const { return m_size; }
+
+private:
+	const uint8_t* m_map = nullptr;
+	size_t m_size = 0, m_pos = 0;
+};